@@ -0,0 +1,2985 @@
+/*
+ * libqxf2qif.cpp
+ *
+ * QXF (OFX/SGML) parsing and QIF output: the converter behind the qxf2qif
+ * program, and the C interface declared in qxf2qif.h.
+ *
+ * Nothing here keeps global mutable state, so any number of conversions
+ * may run at once on separate buffers. Everything but the C interface is
+ * in namespace qxf2qif::detail and built with hidden visibility, so the
+ * library exports only the qxf2qif_* functions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+#include <algorithm>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "qxf2qif_internal.h"
+
+namespace qxf2qif::detail {
+
+/* Read f from its current position to EOF into a malloc'd, NUL
+ * terminated buffer; sets *out_len. Works for pipes and other
+ * non-seekable files by growing the buffer as data arrives. f is left
+ * open. Returns NULL on error.
+ */
+static char *read_stream_all(FILE *f, long *out_len) {
+    char *buf = NULL;
+    long len = 0;
+    struct stat st;
+    if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) &&
+        fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+        buf = (char *)malloc(len + 1);
+        if (!buf) return NULL;
+        if (fread(buf, 1, len, f) != (size_t)len) { free(buf); return NULL; }
+    } else {
+        /* not seekable: read until EOF */
+        size_t cap = 64 * 1024, n;
+        len = 0;
+        clearerr(f);
+        buf = (char *)malloc(cap + 1);
+        if (!buf) return NULL;
+        while ((n = fread(buf + len, 1, cap - len, f)) > 0) {
+            len += (long)n;
+            if ((size_t)len == cap) {
+                char *nb = (char *)realloc(buf, cap * 2 + 1);
+                if (!nb) { free(buf); return NULL; }
+                buf = nb;
+                cap *= 2;
+            }
+        }
+        if (ferror(f)) { free(buf); return NULL; }
+    }
+    buf[len] = '\0';
+    if (out_len) *out_len = len;
+    return buf;
+}
+
+/* Read whole file into a malloc'd buffer. Returns pointer and sets length.
+ * Works for pipes and other non-seekable files by growing the buffer as
+ * data arrives. Caller must free() returned pointer. Returns NULL on error.
+ */
+char *read_file_all(const char *path, long *out_len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    char *buf = read_stream_all(f, out_len);
+    fclose(f);
+    return buf;
+}
+
+/* Map the regular file open on fd read-only so the parser can run over
+ * the page cache in place. The mapping is placed at the front of an
+ * anonymous reservation one byte longer than the file, so data[len] is
+ * always a zero byte even when the file size is an exact multiple of the
+ * page size. fd stays open and at its start either way.
+ * Returns 1 on success, 0 if the file cannot be mapped (caller falls back).
+ */
+static int map_file(int fd, bool populate, InputBuffer *in) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) return 0;
+
+    size_t len = (size_t)st.st_size;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t map_len = (len + 1 + page - 1) & ~(page - 1);
+
+    void *base = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return 0;
+
+    int flags = MAP_PRIVATE | MAP_FIXED;
+#ifdef MAP_POPULATE
+    if (populate) flags |= MAP_POPULATE;
+#else
+    (void)populate;
+#endif
+    if (mmap(base, len, PROT_READ, flags, fd, 0) == MAP_FAILED) {
+        munmap(base, map_len);
+        return 0;
+    }
+    madvise(base, len, MADV_SEQUENTIAL);
+
+    in->data = (const char *)base;
+    in->len = len;
+    in->map_len = map_len;
+    return 1;
+}
+
+/* Load input: mmap regular files, read everything else. The path is
+ * opened once, so a FIFO is read from the same open as its writer sees.
+ * Returns 1 on success, 0 on error. Release with input_close().
+ */
+int input_open(const char *path, bool populate, InputBuffer *in) {
+    in->data = NULL;
+    in->len = 0;
+    in->map_len = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    if (map_file(fd, populate, in)) {
+        close(fd);
+        return 1;
+    }
+
+    FILE *f = fdopen(fd, "rb");
+    if (!f) {
+        close(fd);
+        return 0;
+    }
+    long len;
+    char *buf = read_stream_all(f, &len);
+    fclose(f);
+    if (!buf) return 0;
+    in->data = buf;
+    in->len = (size_t)len;
+    return 1;
+}
+
+void input_close(InputBuffer *in) {
+    if (!in->data) return;
+    if (in->map_len) munmap((void *)in->data, in->map_len);
+    else free((void *)in->data);
+    in->data = NULL;
+}
+
+/*
+ * Tag delimiter scanning.
+ *
+ * delim_scan() records the offsets of every '<' and '>' in a byte range,
+ * in order, so the tokenizer can step from tag boundary to tag boundary
+ * without testing the bytes in between one at a time. The kernel is
+ * chosen once at startup from the CPU features (AVX-512BW, AVX2, SSE2,
+ * else scalar). Setting QXF2QIF_SIMD=scalar|sse2|avx2|avx512 caps the
+ * choice, which is useful for comparing kernels.
+ */
+#define DELIM_MAX_BLOCK 64
+
+/* Kernels scan whole blocks only while pos[] has room for DELIM_MAX_BLOCK
+ * more entries. They return the number of positions written and set
+ * *consumed to the number of bytes examined.
+ */
+typedef size_t (*delim_scan_fn)(const char *p, size_t len, uint32_t *pos, size_t cap, size_t *consumed);
+
+static size_t delim_scan_scalar(const char *p, size_t len, uint32_t *pos, size_t cap, size_t *consumed) {
+    size_t n = 0, i = 0;
+    for (; i < len && n < cap; i++) {
+        if (p[i] == '<' || p[i] == '>') pos[n++] = (uint32_t)i;
+    }
+    *consumed = i;
+    return n;
+}
+
+#if defined(__SSE2__)
+static size_t delim_scan_sse2(const char *p, size_t len, uint32_t *pos, size_t cap, size_t *consumed) {
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    size_t n = 0, i = 0;
+    for (; i + 16 <= len && n + DELIM_MAX_BLOCK <= cap; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt)));
+        while (mask) {
+            pos[n++] = (uint32_t)(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    *consumed = i;
+    return n;
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static size_t delim_scan_avx2(const char *p, size_t len, uint32_t *pos, size_t cap, size_t *consumed) {
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i gt = _mm256_set1_epi8('>');
+    size_t n = 0, i = 0;
+    for (; i + 32 <= len && n + DELIM_MAX_BLOCK <= cap; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, lt), _mm256_cmpeq_epi8(v, gt)));
+        while (mask) {
+            pos[n++] = (uint32_t)(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    *consumed = i;
+    return n;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t delim_scan_avx512(const char *p, size_t len, uint32_t *pos, size_t cap, size_t *consumed) {
+    const __m512i lt = _mm512_set1_epi8('<');
+    const __m512i gt = _mm512_set1_epi8('>');
+    size_t n = 0, i = 0;
+    for (; i + 64 <= len && n + DELIM_MAX_BLOCK <= cap; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void *)(p + i));
+        uint64_t mask = _mm512_cmpeq_epi8_mask(v, lt) | _mm512_cmpeq_epi8_mask(v, gt);
+        while (mask) {
+            pos[n++] = (uint32_t)(i + __builtin_ctzll(mask));
+            mask &= mask - 1;
+        }
+    }
+    *consumed = i;
+    return n;
+}
+#endif
+
+static delim_scan_fn delim_scan_select(void) {
+    int level = 3;  /* 0 scalar, 1 sse2, 2 avx2, 3 avx512 */
+    const char *env = getenv("QXF2QIF_SIMD");
+    if (env) {
+        if (strcmp(env, "scalar") == 0) level = 0;
+        else if (strcmp(env, "sse2") == 0) level = 1;
+        else if (strcmp(env, "avx2") == 0) level = 2;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (level >= 3 && __builtin_cpu_supports("avx512bw")) return delim_scan_avx512;
+    if (level >= 2 && __builtin_cpu_supports("avx2")) return delim_scan_avx2;
+#endif
+#if defined(__SSE2__)
+    if (level >= 1) return delim_scan_sse2;
+#endif
+    (void)level;
+    return delim_scan_scalar;
+}
+
+static const delim_scan_fn delim_scan_kernel = delim_scan_select();
+
+/* Record the offsets of '<' and '>' in [p, p+len) into pos (cap must be at
+ * least DELIM_MAX_BLOCK). Returns the count; *consumed is set to the
+ * number of bytes covered, which is less than len only when pos filled up.
+ */
+static size_t delim_scan(const char *p, size_t len, uint32_t *pos, size_t cap, size_t *consumed) {
+    size_t done;
+    size_t n = delim_scan_kernel(p, len, pos, cap, &done);
+    if (done < len && cap - n >= DELIM_MAX_BLOCK) {
+        /* tail shorter than one vector block */
+        size_t tail;
+        size_t m = delim_scan_scalar(p + done, len - done, pos + n, cap - n, &tail);
+        for (size_t i = n; i < n + m; i++) pos[i] += (uint32_t)done;
+        n += m;
+        done += tail;
+    }
+    *consumed = done;
+    return n;
+}
+
+/* Return the first c ('<' or '>') in [p, end), or end if there is none */
+static const char *delim_find(const char *p, const char *end, char c) {
+    uint32_t pos[DELIM_MAX_BLOCK * 2];
+    while (p < end) {
+        size_t consumed;
+        size_t n = delim_scan(p, (size_t)(end - p), pos, sizeof(pos) / sizeof(pos[0]), &consumed);
+        for (size_t i = 0; i < n; i++) {
+            if (p[pos[i]] == c) return p + pos[i];
+        }
+        p += consumed;
+    }
+    return end;
+}
+
+/* ASCII case folding, independent of the C locale */
+struct FoldTable {
+    unsigned char t[256];
+    constexpr FoldTable() : t() {
+        for (int c = 0; c < 256; c++) t[c] = (unsigned char)((c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c);
+    }
+};
+static constexpr FoldTable fold_table;
+
+#define FOLD(c) (fold_table.t[(unsigned char)(c)])
+
+/* Compare n bytes case-insensitively. Returns true if equal. */
+bool fold_equal(const char *a, const char *b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (FOLD(a[i]) != FOLD(b[i])) return false;
+    }
+    return true;
+}
+
+/* Precomputed case-insensitive Boyer-Moore-Horspool search for one needle.
+ * shift[] is indexed by the raw haystack byte under the last needle
+ * position (both cases are filled in), so a mismatch usually skips the
+ * whole needle length.
+ */
+#define CASE_SEARCH_MAX 255
+
+typedef struct {
+    size_t        len;
+    unsigned char needle[CASE_SEARCH_MAX];  /* folded */
+    unsigned char shift[256];
+} CaseSearcher;
+
+/* Returns 1 on success, 0 if the needle is longer than CASE_SEARCH_MAX. */
+static int case_search_init(CaseSearcher *cs, const char *needle, size_t nlen) {
+    if (nlen > CASE_SEARCH_MAX) return 0;
+    cs->len = nlen;
+    for (size_t i = 0; i < nlen; i++) cs->needle[i] = FOLD(needle[i]);
+    memset(cs->shift, (int)(nlen ? nlen : 1), sizeof(cs->shift));
+    for (size_t i = 0; i + 1 < nlen; i++) {
+        unsigned char c = cs->needle[i];
+        cs->shift[c] = (unsigned char)(nlen - 1 - i);
+        if (c >= 'a' && c <= 'z') cs->shift[c - ('a' - 'A')] = cs->shift[c];
+    }
+    return 1;
+}
+
+static CaseSearcher make_case_searcher(const char *needle) {
+    CaseSearcher cs;
+    case_search_init(&cs, needle, strlen(needle));
+    return cs;
+}
+
+static char *case_search(const CaseSearcher *cs, const char *hay, size_t hlen) {
+    size_t nlen = cs->len;
+    if (nlen == 0) return (char *)hay;
+    if (nlen > hlen) return NULL;
+    const unsigned char *h = (const unsigned char *)hay;
+    const unsigned char *n = cs->needle;
+    unsigned char last = n[nlen - 1];
+    size_t i = 0;
+    while (i <= hlen - nlen) {
+        unsigned char c = h[i + nlen - 1];
+        if (FOLD(c) == last) {
+            size_t k = nlen - 1;
+            while (k > 0 && FOLD(h[i + k - 1]) == n[k - 1]) k--;
+            if (k == 0) return (char *)(hay + i);
+        }
+        i += cs->shift[c];
+    }
+    return NULL;
+}
+
+/* Case-insensitive search for needle in the first hlen bytes of hay.
+ * Returns pointer to first match or NULL.
+ */
+static char *memcasemem(const char *hay, size_t hlen, const char *needle, size_t nlen) {
+    CaseSearcher cs;
+    if (case_search_init(&cs, needle, nlen)) return case_search(&cs, hay, hlen);
+
+    /* very long needle: plain scan */
+    if (nlen > hlen) return NULL;
+    for (size_t i = 0; i <= hlen - nlen; i++) {
+        if (fold_equal(hay + i, needle, nlen)) return (char *)(hay + i);
+    }
+    return NULL;
+}
+
+/* Case-insensitive search for substring in haystack.
+ * Returns pointer to first match or NULL.
+ */
+char *strcasestr_simple(const char *hay, const char *needle) {
+    const size_t window = 4096;
+    size_t nlen = strlen(needle);
+    CaseSearcher cs;
+    if (!case_search_init(&cs, needle, nlen)) return memcasemem(hay, strlen(hay), needle, nlen);
+
+    /* search window by window so an early match does not pay for
+       strlen() of the whole haystack; windows overlap by nlen - 1 */
+    for (;;) {
+        size_t avail = strnlen(hay, window + nlen);
+        char *r = case_search(&cs, hay, avail);
+        if (r || avail < window + nlen) return r;
+        hay += window + 1;
+    }
+}
+
+/*
+ * Extracts the text content of an OFX/QFX tag without advancing block_start.
+ *
+ * Supports both long tags (<TAG>value</TAG>) and short tags (<TAG>value<OTHER>),
+ * and tolerates missing closing tags (common in QFX).
+ *
+ * The search never looks past end, so a tag missing from this block costs
+ * at most the block size instead of a scan to the end of the file.
+ *
+ * Parameters:
+ *   src      = pointer to the start of the STMTTRN block
+ *   end      = pointer one past the end of the block
+ *   tag      = name of the tag without angle brackets, e.g. "NAME"
+ *   out      = destination buffer
+ *   outsize  = size of the destination buffer
+ */
+void extract_tag_content(const char *src, const char *end, const char *tag,
+                         char *out, size_t outsize)
+{
+    /* Initialize output */
+    if (outsize > 0)
+        out[0] = '\0';
+
+    if (!src || !end || end < src || !tag || !out || outsize == 0)
+        return;
+
+    char open_tag[64];
+    char close_tag[64];
+
+    /* Build tag strings */
+    int open_len = snprintf(open_tag, sizeof(open_tag), "<%s>", tag);
+    int close_len = snprintf(close_tag, sizeof(close_tag), "</%s>", tag);
+    if (open_len < 0 || close_len < 0 || (size_t)close_len >= sizeof(close_tag))
+        return;
+
+    const char *p = (const char *)memmem(src, (size_t)(end - src), open_tag, (size_t)open_len);
+    if (!p)
+        return;   /* Tag not found */
+
+    p += open_len;  /* Move past <TAG> */
+
+    /* Try to find the closing tag */
+    const char *q = (const char *)memmem(p, (size_t)(end - p), close_tag, (size_t)close_len);
+
+    if (!q) {
+        /*
+         * No </TAG> found → short-tag extraction.
+         *
+         * Short-tag syntax (common in QFX):
+         *     <NAME>Payment to Card<MEMO>Some memo here
+         * OR
+         *     <TRNAMT>-25.62
+         *
+         * We stop at:
+         *   - the next '<'
+         *   - end of block
+         */
+        q = delim_find(p, end, '<');  /* Start of next tag, or end */
+    }
+
+    size_t len = q - p;
+    if (len >= outsize) len = outsize - 1;
+
+    memcpy(out, p, len);
+    out[len] = '\0';
+}
+
+/* Trim leading and trailing whitespace in place */
+void trim_inplace(char *s) {
+    char *p = s;
+    while (*p && isspace((unsigned char)*p)) p++;
+    if (p != s) memmove(s, p, strlen(p) + 1);
+    size_t len = strlen(s);
+    while (len > 0 && isspace((unsigned char)s[len - 1])) { s[len - 1] = '\0'; len--; }
+}
+
+/* Decimal digit values, -1 for every other byte */
+struct DigitTable {
+    int8_t v[256];
+    constexpr DigitTable() : v() {
+        for (int i = 0; i < 256; i++) v[i] = (i >= '0' && i <= '9') ? (int8_t)(i - '0') : (int8_t)-1;
+    }
+};
+static constexpr DigitTable digit_table;
+
+#define DIGIT(c) (digit_table.v[(unsigned char)(c)])
+
+/* Value of the n digits at p, or a negative number if any is not a digit.
+ * The check is folded into one test at the end. */
+static inline int parse_digits(const char *p, int n) {
+    int v = 0, bad = 0;
+    for (int i = 0; i < n; i++) {
+        int d = DIGIT(p[i]);
+        bad |= d;
+        v = v * 10 + d;
+    }
+    return bad < 0 ? -1 : v;
+}
+
+static const uint8_t month_days[13] = { 0, 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+static bool leap_year(int y) {
+    return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+}
+
+/* Parse the zone suffix "[+-H[.F][:NAME]]" starting at p[0] == '['.
+ * Returns the bytes consumed, 0 if it is malformed. */
+static size_t parse_ofx_zone(const char *p, size_t n, OfxDateTime *dt) {
+    size_t i = 1;
+    int sign = 1;
+    if (i < n && (p[i] == '+' || p[i] == '-')) sign = p[i++] == '-' ? -1 : 1;
+    int hours = 0, digits = 0;
+    while (i < n && DIGIT(p[i]) >= 0 && digits < 2) hours = hours * 10 + DIGIT(p[i++]), digits++;
+    if (digits == 0) return 0;
+    int minutes = hours * 60;
+    if (i < n && p[i] == '.') {
+        /* fractional hours, e.g. -3.5 for Newfoundland */
+        int frac = 0, scale = 1;
+        for (i++; i < n && DIGIT(p[i]) >= 0; i++) {
+            if (scale < 100) frac = frac * 10 + DIGIT(p[i]), scale *= 10;
+        }
+        minutes += frac * 60 / scale;
+    }
+    if (minutes > 14 * 60) return 0;
+    char name[sizeof(dt->zone)];
+    size_t len = 0;
+    if (i < n && p[i] == ':') {
+        for (i++; i < n && isalpha((unsigned char)p[i]); i++) {
+            if (len < sizeof(name) - 1) name[len++] = p[i];
+        }
+    }
+    if (i >= n || p[i] != ']') return 0;
+    memcpy(dt->zone, name, len);
+    dt->zone[len] = '\0';
+    dt->offset_minutes = (int16_t)(sign * minutes);
+    dt->has_zone = true;
+    return i + 1;
+}
+
+/* Parse an OFX date and time in one pass:
+ *     YYYYMMDD[HHMM[SS[.XXX]]][[+-H[.F][:NAME]]]
+ * The date is required and range checked (month, and day against the
+ * length of that month). A time or zone that does not parse or is out of
+ * range is left out and ends the token.
+ * Returns the number of bytes used, 0 if p[0, n) does not start with a
+ * valid date.
+ */
+size_t ofx_parse_datetime(const char *p, size_t n, OfxDateTime *dt) {
+    if (n < 8) return 0;
+    int year = parse_digits(p, 4), month = parse_digits(p + 4, 2), day = parse_digits(p + 6, 2);
+    if ((year | month | day) < 0 || (unsigned)(month - 1) > 11 || day < 1 || day > month_days[month]
+        || (month == 2 && day == 29 && !leap_year(year)))
+        return 0;
+
+    memset(dt, 0, sizeof(*dt));
+    dt->year = (int16_t)year;
+    dt->month = (int8_t)month;
+    dt->day = (int8_t)day;
+
+    size_t i = 8;
+    if (n - i >= 4) {
+        int hour = parse_digits(p + i, 2), minute = parse_digits(p + i + 2, 2);
+        if ((hour | minute) >= 0 && hour < 24 && minute < 60) {
+            dt->hour = (int8_t)hour;
+            dt->minute = (int8_t)minute;
+            dt->has_time = true;
+            i += 4;
+            int second = n - i >= 2 ? parse_digits(p + i, 2) : -1;
+            if (second >= 0 && second <= 60) {
+                dt->second = (int8_t)second;
+                i += 2;
+                if (i < n && p[i] == '.') {
+                    int ms = 0, digits = 0;
+                    while (i + 1 + digits < n && digits < 3 && DIGIT(p[i + 1 + digits]) >= 0)
+                        ms = ms * 10 + DIGIT(p[i + 1 + digits++]);
+                    if (digits > 0) {
+                        for (int k = digits; k < 3; k++) ms *= 10;
+                        dt->millis = (int16_t)ms;
+                        i += 1 + digits;
+                        while (i < n && DIGIT(p[i]) >= 0) i++;  /* sub-millisecond digits */
+                    }
+                }
+            }
+        }
+    }
+    if (i < n && p[i] == '[') i += parse_ofx_zone(p + i, n - i, dt);
+    return i;
+}
+
+/* "00" to "99", for writing two digits at a time */
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static char *put2(char *out, int v) {
+    memcpy(out, digit_pairs + 2 * v, 2);
+    return out + 2;
+}
+
+/* Compile a strftime-style layout. Supported: %Y %y %m %d %H %M %S %%;
+ * every other character is copied as is.
+ * Returns 1 on success, 0 for an unknown conversion or a layout that is
+ * too long.
+ */
+int date_layout_compile(DateLayout *layout, const char *fmt) {
+    layout->n = 0;
+    for (const char *f = fmt; *f; f++) {
+        if (layout->n == DATE_LAYOUT_MAX) return 0;
+        char op = *f, lit = 0;
+        if (op == '%') {
+            op = *++f;
+            if (!op || !strchr("YymdHMS%", op)) return 0;
+            if (op == '%') op = 0, lit = '%';
+        } else {
+            op = 0;
+            lit = *f;
+        }
+        layout->op[layout->n] = op;
+        layout->lit[layout->n] = lit;
+        layout->n++;
+    }
+    return 1;
+}
+
+static DateLayout make_date_layout(const char *fmt) {
+    DateLayout layout;
+    date_layout_compile(&layout, fmt);
+    return layout;
+}
+
+/* The QIF default, MM/DD/YYYY */
+static const DateLayout default_date_layout = make_date_layout(DATE_LAYOUT_DEFAULT);
+
+/* Write dt in layout (NULL for the default) to out, which must have room
+ * for DATE_TEXT_MAX bytes. Returns the length written; nothing is NUL
+ * terminated.
+ */
+size_t date_layout_format(const DateLayout *layout, const OfxDateTime *dt, char *out) {
+    char *o = out;
+    if (!layout) layout = &default_date_layout;
+    for (int k = 0; k < layout->n; k++) {
+        switch (layout->op[k]) {
+        case 'Y': o = put2(put2(o, dt->year / 100 % 100), dt->year % 100); break;
+        case 'y': o = put2(o, dt->year % 100); break;
+        case 'm': o = put2(o, dt->month); break;
+        case 'd': o = put2(o, dt->day); break;
+        case 'H': o = put2(o, dt->hour); break;
+        case 'M': o = put2(o, dt->minute); break;
+        case 'S': o = put2(o, dt->second); break;
+        default:  *o++ = layout->lit[k]; break;
+        }
+    }
+    return (size_t)(o - out);
+}
+
+/* Convert OFX date token (YYYYMMDD... ) to MM/DD/YYYY.
+ * Accepts tokens beginning with a valid YYYYMMDD date.
+ * Writes to out (outlen should be at least 11) in format "MM/DD/YYYY".
+ * Returns 1 on success, 0 on failure.
+ */
+int ofxdate_to_mmddyyyy(const char *token, char *out, size_t outlen) {
+    OfxDateTime dt;
+    if (!token || outlen < 11 || !ofx_parse_datetime(token, strnlen(token, OFX_DATETIME_MAX), &dt)) return 0;
+    out[date_layout_format(&default_date_layout, &dt, out)] = '\0';
+    return 1;
+}
+
+/* Parse an amount such as "-1,234.5" or "+25.60" into cents.
+ * Accepts an optional sign, digits with any number of thousands commas,
+ * and an optional decimal point with up to two significant decimals;
+ * further decimals must be zero, so no value is ever rounded.
+ * Returns 1 on success, 0 if p[0, n) is not such an amount or does not
+ * fit in an int64_t.
+ */
+int amount_parse(const char *p, size_t n, int64_t *cents) {
+    const char *end = p + n;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    uint64_t whole = 0;
+    int digits = 0;
+    for (; p < end; p++) {
+        int d = DIGIT(*p);
+        if (d < 0) {
+            if (*p == ',') continue;
+            break;
+        }
+        if (whole > (uint64_t)(INT64_MAX / 100 - 9) / 10) return 0;
+        whole = whole * 10 + (uint64_t)d;
+        digits++;
+    }
+
+    int frac = 0, fdigits = 0;
+    if (p < end && *p == '.') {
+        for (p++; p < end; p++) {
+            int d = DIGIT(*p);
+            if (d < 0) break;
+            if (fdigits < 2) frac = frac * 10 + d;
+            else if (d != 0) return 0;
+            fdigits++;
+        }
+    }
+    if (p != end || digits + fdigits == 0) return 0;
+    if (fdigits == 1) frac *= 10;
+
+    int64_t v = (int64_t)(whole * 100 + (uint64_t)frac);
+    *cents = negative ? -v : v;
+    return 1;
+}
+
+/* Write cents in canonical form: "-1234.50", "0.05". out needs
+ * AMOUNT_TEXT_MAX bytes. Returns the length; nothing is NUL terminated.
+ */
+size_t amount_format(int64_t cents, char *out) {
+    char tmp[AMOUNT_TEXT_MAX];
+    char *t = tmp + sizeof(tmp);
+    uint64_t v = cents < 0 ? 0 - (uint64_t)cents : (uint64_t)cents;
+
+    t -= 2;
+    memcpy(t, digit_pairs + 2 * (v % 100), 2);
+    *--t = '.';
+    v /= 100;
+    while (v >= 100) {
+        t -= 2;
+        memcpy(t, digit_pairs + 2 * (v % 100), 2);
+        v /= 100;
+    }
+    if (v >= 10) {
+        t -= 2;
+        memcpy(t, digit_pairs + 2 * v, 2);
+    } else {
+        *--t = (char)('0' + v);
+    }
+    if (cents < 0) *--t = '-';
+
+    size_t len = (size_t)(tmp + sizeof(tmp) - t);
+    memcpy(out, t, len);
+    return len;
+}
+
+static const CaseSearcher stmttrn_open_search = make_case_searcher("<STMTTRN");
+static const CaseSearcher stmttrn_close_search = make_case_searcher("</STMTTRN>");
+
+/* Return the start of the first <STMTTRN> tag in [p, end), or end.
+ * Tags that merely start with STMTTRN, such as <STMTTRNRS>, are skipped.
+ */
+static const char *find_stmttrn_tag(const char *p, const char *end) {
+    for (;;) {
+        const char *q = case_search(&stmttrn_open_search, p, (size_t)(end - p));
+        if (!q) return end;
+        p = q + stmttrn_open_search.len;
+        if (p < end && (*p == '>' || isspace((unsigned char)*p))) return q;
+    }
+}
+
+/* Find the first <STMTTRN> start tag in [buf, bufend), then the
+ * </STMTTRN> end tag after it. Returns 1 if found and sets *startptr to
+ * the start of its content and *endptr just past the end tag.
+ * Returns 0 if no more found.
+ */
+int find_next_stmttrn(const char *buf, const char *bufend, const char **startptr, const char **endptr) {
+    const char *p = find_stmttrn_tag(buf, bufend);
+    const char *open = NULL, *close = NULL;
+    if (p == bufend) return 0;
+    p += stmttrn_open_search.len;
+    /* Move to '>' of open tag */
+    open = (const char *)memchr(p, '>', (size_t)(bufend - p));
+    if (!open) return 0;
+    open++; /* content starts here */
+    close = case_search(&stmttrn_close_search, open, (size_t)(bufend - open));
+    if (!close) return 0;
+    *startptr = open;
+    *endptr = close + stmttrn_close_search.len;
+    return 1;
+}
+
+/*
+ * OFX/SGML tokenizer.
+ *
+ * Walks the input once, front to back, and reports each start tag, end
+ * tag and run of character data as an event. Tag names and text are
+ * returned as pointer/length pairs into the input; nothing is copied.
+ * Comments (<!-- -->), CDATA sections, declarations (<!...>) and
+ * processing instructions (<?...?>) are skipped. Text is reported raw
+ * (untrimmed). This covers OFX 2.x XML as well as SGML: XML end tags are
+ * ordinary close events and a self-closing <TAG/> is an open event.
+ */
+typedef enum {
+    OFX_EOF = 0,
+    OFX_OPEN,       /* <TAG>  */
+    OFX_CLOSE,      /* </TAG> */
+    OFX_TEXT        /* character data */
+} OfxEventType;
+
+typedef struct {
+    OfxEventType type;
+    const char  *ptr;   /* tag name (without brackets) or text */
+    size_t       len;
+} OfxEvent;
+
+/* Delimiter positions found by delim_scan() are queued in the lexer and
+ * consumed as it moves forward. */
+#define OFX_LEX_POS 512
+
+typedef struct {
+    const char *begin;
+    const char *p;
+    const char *end;
+    const char *scan_base;  /* pos[] offsets are relative to this */
+    const char *scanned;    /* every delimiter before this has been queued */
+    size_t      npos, ipos;
+    uint32_t    pos[OFX_LEX_POS];
+} OfxLexer;
+
+static void ofx_lex_init(OfxLexer *lx, const char *begin, const char *end) {
+    lx->begin = begin;
+    lx->p = begin;
+    lx->end = end;
+    lx->scan_base = begin;
+    lx->scanned = begin;
+    lx->npos = lx->ipos = 0;
+}
+
+/* Return the first c ('<' or '>') at or after from, or lx->end.
+ * from must not move backwards between calls.
+ */
+static const char *ofx_lex_find(OfxLexer *lx, const char *from, char c) {
+    for (;;) {
+        while (lx->ipos < lx->npos) {
+            const char *d = lx->scan_base + lx->pos[lx->ipos];
+            if (d >= from && *d == c) return d;
+            lx->ipos++;
+        }
+        if (lx->scanned < from) lx->scanned = from;
+        if (lx->scanned >= lx->end) return lx->end;
+        size_t consumed;
+        lx->scan_base = lx->scanned;
+        lx->npos = delim_scan(lx->scanned, (size_t)(lx->end - lx->scanned), lx->pos, OFX_LEX_POS, &consumed);
+        lx->ipos = 0;
+        lx->scanned += consumed;
+    }
+}
+
+/* Return the end of the CDATA section starting at p, just past its "]]>",
+ * or lx->end if it is not closed. */
+static const char *ofx_cdata_end(OfxLexer *lx, const char *p) {
+    const char *q = p + 9;
+    for (;;) {
+        q = ofx_lex_find(lx, q, '>');
+        if (q >= lx->end) return lx->end;
+        if (q - 2 >= p + 9 && q[-1] == ']' && q[-2] == ']') return q + 1;
+        q++;
+    }
+}
+
+/* Advance to the next event. Returns its type (OFX_EOF at end of input). */
+static OfxEventType ofx_lex_next(OfxLexer *lx, OfxEvent *ev) {
+    for (;;) {
+        const char *p = lx->p;
+        const char *end = lx->end;
+        const char *q;
+
+        if (p >= end) {
+            ev->type = OFX_EOF;
+            ev->ptr = end;
+            ev->len = 0;
+            return OFX_EOF;
+        }
+
+        if (*p != '<') {
+            q = ofx_lex_find(lx, p, '<');
+            lx->p = q;
+            ev->type = OFX_TEXT;
+            ev->ptr = p;
+            ev->len = (size_t)(q - p);
+            return OFX_TEXT;
+        }
+
+        if (end - p >= 4 && memcmp(p, "<!--", 4) == 0) {
+            /* comment: skip to "-->" */
+            q = p + 4;
+            for (;;) {
+                q = ofx_lex_find(lx, q, '>');
+                if (q >= end || (q - 2 >= p + 4 && q[-1] == '-' && q[-2] == '-')) break;
+                q++;
+            }
+            lx->p = (q < end) ? q + 1 : end;
+            continue;
+        }
+        if (end - p >= 9 && p[1] == '!' && memcmp(p, "<![CDATA[", 9) == 0) {
+            lx->p = ofx_cdata_end(lx, p);
+            continue;
+        }
+
+        q = ofx_lex_find(lx, p + 1, '>');
+        if (q >= end) {
+            /* unterminated tag: nothing more to report */
+            lx->p = end;
+            continue;
+        }
+        lx->p = q + 1;
+
+        if (p + 1 < q && (p[1] == '!' || p[1] == '?')) continue;
+
+        const char *name = p + 1;
+        ev->type = OFX_OPEN;
+        if (name < q && *name == '/') {
+            ev->type = OFX_CLOSE;
+            name++;
+        }
+        const char *name_end = name;
+        while (name_end < q && !isspace((unsigned char)*name_end) && *name_end != '/') name_end++;
+        ev->ptr = name;
+        ev->len = (size_t)(name_end - name);
+        return ev->type;
+    }
+}
+
+/* Case-insensitive compare of an event's tag name with an uppercase name */
+static bool ofx_tag_is(const OfxEvent *ev, const char *tag, size_t tag_len) {
+    return ev->len == tag_len && fold_equal(ev->ptr, tag, tag_len);
+}
+
+#define OFX_TAG_IS(ev, lit) ofx_tag_is((ev), (lit), sizeof(lit) - 1)
+
+/* A field value as an offset and length into the buffer being parsed */
+typedef struct {
+    size_t off;
+    size_t len;
+} FieldView;
+
+/* Raw field text of one <STMTTRN>, as views into base. Nothing is copied;
+ * trimming and newline sanitizing happen when the record is written.
+ */
+typedef struct {
+    const char *base;
+    FieldView   dtposted;
+    FieldView   trnamt;
+    FieldView   fitid;
+    FieldView   name;
+    FieldView   memo;
+} Transaction;
+
+static const char *field_ptr(const Transaction *t, FieldView f) {
+    return t->base + f.off;
+}
+
+/* Return f without leading and trailing whitespace */
+static FieldView field_trim(const Transaction *t, FieldView f) {
+    const char *p = field_ptr(t, f);
+    while (f.len > 0 && isspace((unsigned char)*p)) { p++; f.off++; f.len--; }
+    while (f.len > 0 && isspace((unsigned char)p[f.len - 1])) f.len--;
+    return f;
+}
+
+/* Record the text of the element whose start tag was just read.
+ * In SGML the value is the character data that immediately follows the
+ * start tag; an element with no text gets an empty view. In XML the text
+ * may continue through CDATA sections, which the view then includes, and
+ * a self-closing <TAG/> has none.
+ */
+static void ofx_read_value(OfxLexer *lx, const char *base, FieldView *out) {
+    const char *p = lx->p;
+    const char *q = p;
+    out->off = (size_t)(p - base);
+    if (p - lx->begin >= 2 && p[-2] == '/') {
+        out->len = 0;
+        return;
+    }
+    for (;;) {
+        q = ofx_lex_find(lx, q, '<');
+        if (lx->end - q < 9 || q[1] != '!' || memcmp(q, "<![CDATA[", 9) != 0) break;
+        q = ofx_cdata_end(lx, q);
+    }
+    out->len = (size_t)(q - p);
+    lx->p = q;
+}
+
+/* Fill t from the events of one transaction. The lexer must be positioned
+ * just after an opening <STMTTRN>; it is left after the matching
+ * </STMTTRN>. Views are relative to the start of the lexer's input.
+ * The first occurrence of each field wins.
+ * Returns 1 if the closing tag was reached, 0 if input ended first.
+ */
+static int ofx_read_stmttrn(OfxLexer *lx, Transaction *t) {
+    static const FieldView none = {0, 0};
+    OfxEvent ev;
+
+    t->base = lx->begin;
+    t->dtposted = t->trnamt = t->fitid = t->name = t->memo = none;
+    bool have_date = false, have_amt = false, have_fitid = false, have_name = false, have_memo = false;
+
+    while (ofx_lex_next(lx, &ev) != OFX_EOF) {
+        if (ev.type == OFX_CLOSE) {
+            if (OFX_TAG_IS(&ev, "STMTTRN")) return 1;
+            continue;
+        }
+        if (ev.type != OFX_OPEN) continue;
+
+        if (OFX_TAG_IS(&ev, "STMTTRN")) {
+            /* unclosed transaction: restart with the new one */
+            t->dtposted = t->trnamt = t->fitid = t->name = t->memo = none;
+            have_date = have_amt = have_fitid = have_name = have_memo = false;
+        } else if (!have_date && OFX_TAG_IS(&ev, "DTPOSTED")) {
+            ofx_read_value(lx, t->base, &t->dtposted);
+            have_date = true;
+        } else if (!have_amt && OFX_TAG_IS(&ev, "TRNAMT")) {
+            ofx_read_value(lx, t->base, &t->trnamt);
+            have_amt = true;
+        } else if (!have_fitid && OFX_TAG_IS(&ev, "FITID")) {
+            ofx_read_value(lx, t->base, &t->fitid);
+            have_fitid = true;
+        } else if (!have_name && OFX_TAG_IS(&ev, "NAME")) {
+            ofx_read_value(lx, t->base, &t->name);
+            have_name = true;
+        } else if (!have_memo && OFX_TAG_IS(&ev, "MEMO")) {
+            ofx_read_value(lx, t->base, &t->memo);
+            have_memo = true;
+        }
+    }
+    return 0;
+}
+
+/* Output buffer sizing: typical STMTTRN blocks are ~200 bytes of input
+ * and become ~64 bytes of QIF. */
+#define OUTBUF_MAX          (16 * 1024 * 1024)
+#define OUTBUF_IN_PER_TRN   200
+#define OUTBUF_OUT_PER_TRN  64
+
+/* Buffer size for converting input_len bytes: room for the whole
+ * estimated output, clamped to [OUTBUF_MIN, OUTBUF_MAX]. */
+size_t outbuf_estimate(size_t input_len) {
+    size_t est = (input_len / OUTBUF_IN_PER_TRN + 1) * OUTBUF_OUT_PER_TRN;
+    if (est < OUTBUF_MIN) est = OUTBUF_MIN;
+    if (est > OUTBUF_MAX) est = OUTBUF_MAX;
+    return est;
+}
+
+/* The last buffer a thread freed, kept for its next outbuf_init() so that
+ * a thread converting file after file writes into memory that is already
+ * mapped instead of faulting in a fresh allocation each time. Only
+ * threads that ask for it with outbuf_keep_spare() keep one. */
+struct SpareBuffer {
+    bool   enabled = false;
+    char  *data = NULL;
+    size_t cap = 0;
+    ~SpareBuffer() { free(data); }
+};
+static thread_local SpareBuffer spare_buffer;
+
+/* Keep (on) the calling thread's last freed buffer, up to OUTBUF_MAX
+ * bytes, for reuse until the thread exits; or stop (off) and release it */
+void outbuf_keep_spare(bool on) {
+    spare_buffer.enabled = on;
+    if (!on) {
+        free(spare_buffer.data);
+        spare_buffer.data = NULL;
+        spare_buffer.cap = 0;
+    }
+}
+
+/* Returns 1 on success, 0 on allocation failure. */
+int outbuf_init(OutBuf *ob, int fd, size_t cap) {
+    ob->fd = fd;
+    ob->sink = NULL;
+    ob->sink_user = NULL;
+    ob->times = NULL;
+    ob->len = 0;
+    ob->error = false;
+    if (cap >= OUTBUF_MIN && spare_buffer.data && spare_buffer.cap >= cap) {
+        ob->data = spare_buffer.data;
+        ob->cap = spare_buffer.cap;
+        spare_buffer.data = NULL;
+        spare_buffer.cap = 0;
+        return 1;
+    }
+    ob->cap = cap;
+    ob->data = (char *)malloc(cap);
+    return ob->data != NULL;
+}
+
+/* Like outbuf_init(), but full buffers are passed to sink instead of
+ * being written to a file descriptor. */
+int outbuf_init_sink(OutBuf *ob, qxf2qif_write_fn sink, void *user, size_t cap) {
+    if (!outbuf_init(ob, -1, cap)) return 0;
+    ob->sink = sink;
+    ob->sink_user = user;
+    return 1;
+}
+
+void outbuf_free(OutBuf *ob) {
+    if (spare_buffer.enabled && ob->data && ob->cap > spare_buffer.cap && ob->cap <= OUTBUF_MAX) {
+        free(spare_buffer.data);
+        spare_buffer.data = ob->data;
+        spare_buffer.cap = ob->cap;
+    } else {
+        free(ob->data);
+    }
+    ob->data = NULL;
+}
+
+/* True if the buffer keeps all output in memory */
+static bool outbuf_grows(const OutBuf *ob) {
+    return ob->fd < 0 && !ob->sink;
+}
+
+static void write_out(OutBuf *ob, const char *p, size_t n) {
+    if (ob->sink) {
+        if (n > 0 && !ob->error && ob->sink(ob->sink_user, p, n) != 0) ob->error = true;
+        return;
+    }
+    while (n > 0 && !ob->error) {
+        ssize_t w = write(ob->fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            ob->error = true;
+            break;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+}
+
+static void write_all(OutBuf *ob, const char *p, size_t n) {
+    if (!ob->times) {
+        write_out(ob, p, n);
+        return;
+    }
+    double wall = now_seconds(), cpu = thread_cpu_seconds();
+    write_out(ob, p, n);
+    ob->times->wall[PHASE_WRITE] += now_seconds() - wall;
+    ob->times->cpu[PHASE_WRITE] += thread_cpu_seconds() - cpu;
+}
+
+/* Write out everything buffered. Returns 1 on success, 0 if any write
+ * since outbuf_init() failed. */
+int outbuf_flush(OutBuf *ob) {
+    write_all(ob, ob->data, ob->len);
+    ob->len = 0;
+    return !ob->error;
+}
+
+/* Make room for n more bytes, flushing (or growing an in-memory buffer)
+ * if needed. Returns a pointer to the free space, or NULL if n does not
+ * fit even in an empty buffer or the buffer cannot grow. */
+static char *outbuf_reserve(OutBuf *ob, size_t n) {
+    if (ob->cap - ob->len < n) {
+        if (outbuf_grows(ob)) {
+            size_t cap = ob->cap * 2;
+            if (cap < ob->len + n) cap = ob->len + n;
+            char *nd = (char *)realloc(ob->data, cap);
+            if (!nd) { ob->error = true; return NULL; }
+            ob->data = nd;
+            ob->cap = cap;
+        } else {
+            outbuf_flush(ob);
+            if (ob->cap < n) return NULL;
+        }
+    }
+    return ob->data + ob->len;
+}
+
+void outbuf_put(OutBuf *ob, const char *p, size_t n) {
+    char *dst = outbuf_reserve(ob, n);
+    if (!dst) {
+        /* larger than the whole buffer: write it directly */
+        if (!outbuf_grows(ob)) write_all(ob, p, n);
+        return;
+    }
+    memcpy(dst, p, n);
+    ob->len += n;
+}
+
+static void outbuf_putc(OutBuf *ob, char c) {
+    if (ob->len == ob->cap && !outbuf_reserve(ob, 1)) return;
+    ob->data[ob->len++] = c;
+}
+
+/* Append field text, turning CR and LF into spaces */
+static void outbuf_text(OutBuf *ob, const char *p, size_t n) {
+    char *dst = outbuf_reserve(ob, n);
+    if (!dst) {
+        if (outbuf_grows(ob)) return;
+        while (n > 0) {
+            size_t chunk = n < ob->cap ? n : ob->cap;
+            outbuf_text(ob, p, chunk);
+            p += chunk;
+            n -= chunk;
+        }
+        return;
+    }
+    memcpy(dst, p, n);
+    for (char *q = dst; (q = (char *)memchr(q, '\n', (size_t)(dst + n - q))) != NULL; ) *q = ' ';
+    for (char *q = dst; (q = (char *)memchr(q, '\r', (size_t)(dst + n - q))) != NULL; ) *q = ' ';
+    ob->len += n;
+}
+
+/*
+ * Arena.
+ *
+ * Records kept past the parse are carved from large blocks by bumping a
+ * pointer, so a file's worth of them costs a few malloc calls, never
+ * moves once written, and goes away in one step. A reset keeps the
+ * blocks for the next file.
+ */
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t      size;       /* bytes after the header */
+};
+
+void arena_init(Arena *a) {
+    a->first = NULL;
+    a->current = NULL;
+    a->ptr = NULL;
+    a->end = NULL;
+    a->used = 0;
+}
+
+/* Move to a block after the current one with room for n bytes, reusing
+ * one kept by arena_reset() if it is large enough. Returns 1 on success,
+ * 0 if out of memory. */
+static int arena_grow(Arena *a, size_t n) {
+    ArenaBlock *b = a->current ? a->current->next : a->first;
+    while (b && b->size < n) b = b->next;
+    if (!b) {
+        size_t size = n > ARENA_BLOCK ? n : ARENA_BLOCK;
+        b = (ArenaBlock *)malloc(sizeof(ArenaBlock) + size);
+        if (!b) return 0;
+        b->size = size;
+        if (a->current) {
+            b->next = a->current->next;
+            a->current->next = b;
+        } else {
+            b->next = a->first;
+            a->first = b;
+        }
+    }
+    a->current = b;
+    a->ptr = (char *)(b + 1);
+    a->end = a->ptr + b->size;
+    return 1;
+}
+
+/* n bytes aligned to 8, valid until the next reset; NULL if out of memory */
+void *arena_alloc(Arena *a, size_t n) {
+    n = (n + 7) & ~(size_t)7;
+    if ((size_t)(a->end - a->ptr) < n && !arena_grow(a, n)) return NULL;
+    void *p = a->ptr;
+    a->ptr += n;
+    a->used += n;
+    return p;
+}
+
+/* Release everything allocated, keeping the blocks for reuse */
+void arena_reset(Arena *a) {
+    a->current = NULL;
+    a->ptr = NULL;
+    a->end = NULL;
+    a->used = 0;
+}
+
+void arena_free(Arena *a) {
+    for (ArenaBlock *b = a->first; b; ) {
+        ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    arena_init(a);
+}
+
+size_t arena_used(const Arena *a) {
+    return a->used;
+}
+
+/*
+ * Character sets.
+ *
+ * OFX 1.x declares the text encoding in its SGML header (ENCODING and
+ * CHARSET). NAME and MEMO text in a single-byte charset is converted to
+ * UTF-8 through a 256-entry table; runs of ASCII, which need no change,
+ * are found with SIMD and copied as they are.
+ */
+
+/* UTF-8 form of every byte of a single-byte charset: the bytes in the
+ * low 24 bits, first byte lowest, and the length in the top 8 bits. */
+struct Utf8Table {
+    uint32_t e[256];
+    constexpr Utf8Table(const uint16_t *c1) : e() {
+        for (int b = 0; b < 256; b++) {
+            uint32_t cp = (b >= 0x80 && b < 0xA0) ? c1[b - 0x80] : (uint32_t)b;
+            if (cp < 0x80)
+                e[b] = cp | 1u << 24;
+            else if (cp < 0x800)
+                e[b] = (0xC0 | cp >> 6) | (0x80 | (cp & 0x3F)) << 8 | 2u << 24;
+            else
+                e[b] = (0xE0 | cp >> 12) | (0x80 | (cp >> 6 & 0x3F)) << 8
+                       | (0x80 | (cp & 0x3F)) << 16 | 3u << 24;
+        }
+    }
+};
+
+/* Windows-1252 in 0x80-0x9F; the five unassigned bytes keep their C1
+ * code points, as browsers do */
+static constexpr uint16_t cp1252_c1[32] = {
+    0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+    0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178
+};
+static constexpr Utf8Table cp1252_table(cp1252_c1);
+
+/* Copy value (without surrounding blanks) into out, truncated */
+static void header_value(const char *p, const char *end, char *out, size_t outsize) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    while (end > p && isspace((unsigned char)end[-1])) end--;
+    size_t n = (size_t)(end - p) < outsize - 1 ? (size_t)(end - p) : outsize - 1;
+    memcpy(out, p, n);
+    out[n] = '\0';
+}
+
+/* Read the encoding="..." pseudo-attribute of the <?xml ...?> declaration
+ * at p, if it has one. */
+static void xml_decl_encoding(const char *p, const char *end, OfxHeader *h) {
+    const char *close = (const char *)memmem(p, (size_t)(end - p), "?>", 2);
+    if (!close) return;
+    const char *a = (const char *)memmem(p, (size_t)(close - p), "encoding", 8);
+    if (!a) return;
+    a += 8;
+    while (a < close && isspace((unsigned char)*a)) a++;
+    if (a == close || *a++ != '=') return;
+    while (a < close && isspace((unsigned char)*a)) a++;
+    if (a == close || (*a != '"' && *a != '\'')) return;
+    const char *v = a + 1;
+    const char *ve = (const char *)memchr(v, *a, (size_t)(close - v));
+    if (ve) header_value(v, ve, h->encoding, sizeof(h->encoding));
+}
+
+/* Read the OFX header. OFX 1.x has KEY:VALUE lines before the first tag;
+ * OFX 2.x starts with an <?xml?> declaration and an <?OFX?> instruction
+ * instead, which sets h->xml. Fields that are absent are left empty.
+ */
+void ofx_parse_header(const char *p, size_t n, OfxHeader *h) {
+    const char *start = p;
+    const char *end = p + (n < OFX_HEADER_MAX ? n : OFX_HEADER_MAX);
+    h->encoding[0] = '\0';
+    h->charset[0] = '\0';
+    h->xml = false;
+    if (end - p >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) {
+        /* a byte order mark settles it */
+        strcpy(h->encoding, "UTF-8");
+        p += 3;
+    }
+    while (p < end) {
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p == end) break;
+        if (*p == '<') {
+            if (p - start < OFX_XML_SNIFF && end - p >= 5 && p[1] == '?') {
+                if (fold_equal(p + 2, "XML", 3)) {
+                    h->xml = true;
+                    if (!h->encoding[0]) xml_decl_encoding(p, end, h);
+                } else if (fold_equal(p + 2, "OFX", 3)) {
+                    h->xml = true;
+                }
+            }
+            break;
+        }
+        const char *eol = (const char *)memchr(p, '\n', (size_t)(end - p));
+        if (!eol) eol = end;
+        const char *colon = (const char *)memchr(p, ':', (size_t)(eol - p));
+        if (colon) {
+            size_t klen = (size_t)(colon - p);
+            if (klen == 8 && fold_equal(p, "ENCODING", 8) && !h->encoding[0])
+                header_value(colon + 1, eol, h->encoding, sizeof(h->encoding));
+            else if (klen == 7 && fold_equal(p, "CHARSET", 7))
+                header_value(colon + 1, eol, h->charset, sizeof(h->charset));
+        }
+        p = eol;
+    }
+}
+
+/* Non-zero if name is lit, ignoring ASCII case */
+bool name_is(const char *name, const char *lit) {
+    size_t n = strlen(lit);
+    return strlen(name) == n && fold_equal(name, lit, n);
+}
+
+/* Table that converts the declared charset to UTF-8, or NULL if the text
+ * is UTF-8 already. Latin-1 labels are read as Windows-1252, which only
+ * differs in the C1 range where Latin-1 has no printable characters; an
+ * undeclared charset in an 8-bit file is taken to be Windows-1252 too.
+ * XML without an encoding declaration is UTF-8.
+ */
+static const Utf8Table *header_table(const OfxHeader *h) {
+    if ((h->xml && !h->encoding[0]) || name_is(h->encoding, "UTF-8") || name_is(h->encoding, "UTF8") || name_is(h->encoding, "UNICODE")
+        || name_is(h->charset, "UTF-8") || name_is(h->charset, "UTF8"))
+        return NULL;
+    return &cp1252_table;
+}
+
+/* Options for converting one input whose text starts at head: the
+ * caller's options plus the syntax and charset table its header calls
+ * for. */
+void convert_options_for_input(const ConvertOptions *base, const char *head, size_t len,
+                               ConvertOptions *opts)
+{
+    OfxHeader h;
+    ofx_parse_header(head, len, &h);
+    *opts = *base;
+    opts->xml = h.xml;
+    opts->transcode = base->raw_text ? NULL : header_table(&h);
+}
+
+/* Returns 1 and sets *raw for a known --output-charset name, 0 otherwise */
+int output_charset_parse(const char *name, bool *raw) {
+    if (name_is(name, "utf-8") || name_is(name, "utf8")) *raw = false;
+    else if (name_is(name, "raw")) *raw = true;
+    else return 0;
+    return 1;
+}
+
+/* Length of the ASCII prefix of p[0, n) */
+static size_t ascii_span(const char *p, size_t n) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(p + i)));
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+#else
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        if (w & 0x8080808080808080ull) break;
+    }
+#endif
+    while (i < n && !((unsigned char)p[i] & 0x80)) i++;
+    return i;
+}
+
+/* Non-ASCII bytes converted per outbuf_reserve() call */
+#define TRANSCODE_RUN 1024
+
+/* Append field text like outbuf_text(), converting it to UTF-8 with
+ * table (NULL: copy the bytes as they are). */
+static void outbuf_text_utf8(OutBuf *ob, const char *p, size_t n, const Utf8Table *table) {
+    const char *end = p + n;
+    if (!table) {
+        outbuf_text(ob, p, n);
+        return;
+    }
+    while (p < end) {
+        size_t ascii = ascii_span(p, (size_t)(end - p));
+        if (ascii) outbuf_text(ob, p, ascii);
+        p += ascii;
+
+        const char *run = p;
+        while (p < end && (unsigned char)*p & 0x80 && p - run < TRANSCODE_RUN) p++;
+        if (p == run) continue;
+        char *dst = outbuf_reserve(ob, 3 * (size_t)(p - run));
+        if (!dst) return;
+        for (const char *q = run; q < p; q++) {
+            uint32_t e = table->e[(unsigned char)*q];
+            dst[0] = (char)e;
+            dst[1] = (char)(e >> 8);
+            dst[2] = (char)(e >> 16);
+            dst += e >> 24;
+        }
+        ob->len = (size_t)(dst - ob->data);
+    }
+}
+
+/* Append the UTF-8 form of code point cp as field text */
+static void outbuf_code_point(OutBuf *ob, uint32_t cp) {
+    char u[4];
+    size_t n;
+    if (cp < 0x80) {
+        u[0] = (char)cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        u[0] = (char)(0xC0 | cp >> 6);
+        u[1] = (char)(0x80 | (cp & 0x3F));
+        n = 2;
+    } else if (cp < 0x10000) {
+        u[0] = (char)(0xE0 | cp >> 12);
+        u[1] = (char)(0x80 | (cp >> 6 & 0x3F));
+        u[2] = (char)(0x80 | (cp & 0x3F));
+        n = 3;
+    } else {
+        u[0] = (char)(0xF0 | cp >> 18);
+        u[1] = (char)(0x80 | (cp >> 12 & 0x3F));
+        u[2] = (char)(0x80 | (cp >> 6 & 0x3F));
+        u[3] = (char)(0x80 | (cp & 0x3F));
+        n = 4;
+    }
+    outbuf_text(ob, u, n);
+}
+
+/* Code point of the entity reference at p ("&...;"), setting *len to its
+ * length; 0 if p does not start a reference this converter knows. */
+static uint32_t xml_entity(const char *p, const char *end, size_t *len) {
+    static const struct { char name[6]; uint32_t cp; } named[] = {
+        {"amp;", '&'}, {"lt;", '<'}, {"gt;", '>'}, {"quot;", '"'}, {"apos;", '\''}
+    };
+    const char *semi = (const char *)memchr(p, ';', (size_t)(end - p) < 12 ? (size_t)(end - p) : 12);
+    if (!semi) return 0;
+    *len = (size_t)(semi - p) + 1;
+    if (p[1] != '#') {
+        for (const auto &e : named)
+            if (strlen(e.name) == *len - 1 && memcmp(p + 1, e.name, *len - 1) == 0) return e.cp;
+        return 0;
+    }
+    uint32_t cp = 0;
+    bool hex = p[2] == 'x' || p[2] == 'X';
+    const char *q = p + (hex ? 3 : 2);
+    if (q == semi) return 0;
+    for (; q < semi; q++) {
+        int d;
+        if (*q >= '0' && *q <= '9') d = *q - '0';
+        else if (hex && (*q | 0x20) >= 'a' && (*q | 0x20) <= 'f') d = (*q | 0x20) - 'a' + 10;
+        else return 0;
+        cp = cp * (hex ? 16 : 10) + (uint32_t)d;
+    }
+    if (cp > 0x10FFFF || (cp >= 0xD800 && cp < 0xE000)) return 0;
+    return cp;
+}
+
+/* Append XML character data like outbuf_text_utf8(), with entity
+ * references decoded and CDATA sections copied without their markers.
+ * References this converter does not know are copied as they are.
+ */
+static void outbuf_text_xml(OutBuf *ob, const char *p, size_t n, const Utf8Table *table) {
+    const char *end = p + n;
+    while (p < end) {
+        const char *amp = (const char *)memchr(p, '&', (size_t)(end - p));
+        const char *lt = (const char *)memchr(p, '<', (size_t)((amp ? amp : end) - p));
+        const char *stop = lt ? lt : amp ? amp : end;
+        outbuf_text_utf8(ob, p, (size_t)(stop - p), table);
+        p = stop;
+        if (p == end) break;
+
+        if (*p == '<') {
+            if (end - p >= 9 && memcmp(p, "<![CDATA[", 9) == 0) {
+                const char *data = p + 9;
+                const char *close = (const char *)memmem(data, (size_t)(end - data), "]]>", 3);
+                const char *data_end = close ? close : end;
+                outbuf_text_utf8(ob, data, (size_t)(data_end - data), table);
+                p = close ? close + 3 : end;
+            } else {
+                outbuf_text(ob, p++, 1);
+            }
+            continue;
+        }
+        size_t len;
+        uint32_t cp = xml_entity(p, end, &len);
+        if (cp) {
+            outbuf_code_point(ob, cp);
+            p += len;
+        } else {
+            outbuf_text(ob, p++, 1);
+        }
+    }
+}
+
+/* Append NAME or MEMO text in the output charset */
+static inline void outbuf_field(OutBuf *ob, const char *p, size_t n, const ConvertOptions *opts) {
+    if (opts->xml) outbuf_text_xml(ob, p, n, opts->transcode);
+    else outbuf_text_utf8(ob, p, n, opts->transcode);
+}
+
+/* Append an amount without thousands separators */
+static void outbuf_amount(OutBuf *ob, const char *p, size_t n) {
+    const char *end = p + n;
+    while (p < end) {
+        const char *comma = (const char *)memchr(p, ',', (size_t)(end - p));
+        const char *stop = comma ? comma : end;
+        outbuf_put(ob, p, (size_t)(stop - p));
+        p = comma ? comma + 1 : end;
+    }
+}
+
+/*
+ * Output formats.
+ *
+ * Each transaction is parsed once into a Record and handed to the writer
+ * of every format requested, each with its own output buffer. Statements
+ * are tracked from the same events the transaction scan already walks, so
+ * a file holding several accounts is still read once; formats that have
+ * per-account sections (QIF) write them as each statement begins.
+ */
+
+typedef struct {
+    const char *name;       /* as given to --format */
+    const char *extension;  /* of the output file */
+    void (*begin)(OutBuf *out);                             /* start of document */
+    void (*section)(OutBuf *out, const QifSection *sec);    /* records of another section follow */
+    void (*record)(OutBuf *out, const Record *r, const ConvertOptions *opts);
+} OutputFormat;
+
+extern const DateLayout iso_date_layout = make_date_layout("%Y-%m-%d");
+
+/* Format r's date with layout, or copy the text sent if it did not parse.
+ * out needs DATE_TEXT_MAX bytes. */
+static size_t record_date(const Record *r, const DateLayout *layout, char *out) {
+    if (r->dated) return date_layout_format(layout, &r->dt, out);
+    memcpy(out, r->raw_date, r->raw_date_len);
+    return r->raw_date_len;
+}
+
+/* r's posted date and time as one number that sorts in time order;
+ * INT64_MAX, after all of them, if the date did not parse */
+int64_t record_key(const Record *r) {
+    if (!r->dated) return INT64_MAX;
+    const OfxDateTime *d = &r->dt;
+    int64_t date = (int64_t)d->year * 10000 + d->month * 100 + d->day;
+    return date * 86400000 + ((d->hour * 60 + d->minute) * 60 + d->second) * 1000 + d->millis;
+}
+
+/* Append r's amount: canonical if it parsed, otherwise the text as sent
+ * without thousands separators */
+static void record_amount(OutBuf *out, const Record *r) {
+    if (r->parsed) {
+        char amount[AMOUNT_TEXT_MAX];
+        outbuf_put(out, amount, amount_format(r->cents, amount));
+    } else {
+        outbuf_amount(out, r->raw_amount, r->raw_amount_len);
+    }
+}
+
+/* QIF: a section header per statement, then Date (D), Payee (P),
+ * Memo (M), Amount (T), Cleared (C*), end (^) per record */
+static void qif_section(OutBuf *out, const QifSection *sec) {
+    if (sec->state == SECTION_PENDING && sec->acctid[0]) {
+        OUTBUF_PUT_LIT(out, "!Account\nN");
+        outbuf_text(out, sec->acctid, strlen(sec->acctid));
+        if (sec->type == ACCOUNT_CCARD) OUTBUF_PUT_LIT(out, "\nTCCard\n^\n");
+        else OUTBUF_PUT_LIT(out, "\nTBank\n^\n");
+    }
+    if (sec->state == SECTION_PENDING && sec->type == ACCOUNT_CCARD) OUTBUF_PUT_LIT(out, "!Type:CCard\n");
+    else OUTBUF_PUT_LIT(out, "!Type:Bank\n");
+}
+
+static void qif_record(OutBuf *out, const Record *r, const ConvertOptions *opts) {
+    char date[DATE_TEXT_MAX];
+    outbuf_putc(out, 'D');
+    outbuf_put(out, date, record_date(r, opts->date_layout, date));
+    outbuf_putc(out, '\n');
+
+    /* If name is empty, use a placeholder */
+    if (r->name_len == 0) {
+        OUTBUF_PUT_LIT(out, "P(unknown)\n");
+    } else {
+        outbuf_putc(out, 'P');
+        outbuf_put(out, r->name, r->name_len);
+        outbuf_putc(out, '\n');
+    }
+    if (r->memo_len) {
+        outbuf_putc(out, 'M');
+        outbuf_put(out, r->memo, r->memo_len);
+        outbuf_putc(out, '\n');
+    }
+    outbuf_putc(out, 'T');
+    record_amount(out, r);
+    OUTBUF_PUT_LIT(out, "\nC*\n^\n");
+}
+
+/* CSV (RFC 4180): a header row, then one row per record */
+static void csv_begin(OutBuf *out) {
+    OUTBUF_PUT_LIT(out, "Date,Account,Type,FITID,Payee,Memo,Amount\n");
+}
+
+/* Append a CSV field, quoted if it holds a comma, a quote, CR or LF */
+static void csv_field(OutBuf *out, const char *p, size_t n) {
+    size_t i = 0;
+    while (i < n && p[i] != ',' && p[i] != '"' && p[i] != '\r' && p[i] != '\n') i++;
+    if (i == n) {
+        outbuf_put(out, p, n);
+        return;
+    }
+    const char *end = p + n;
+    outbuf_putc(out, '"');
+    while (p < end) {
+        const char *q = (const char *)memchr(p, '"', (size_t)(end - p));
+        const char *stop = q ? q + 1 : end;
+        outbuf_put(out, p, (size_t)(stop - p));
+        if (q) outbuf_putc(out, '"');
+        p = stop;
+    }
+    outbuf_putc(out, '"');
+}
+
+static void csv_record(OutBuf *out, const Record *r, const ConvertOptions *opts) {
+    char date[DATE_TEXT_MAX];
+    csv_field(out, date, record_date(r, opts->date_layout, date));
+    outbuf_putc(out, ',');
+    csv_field(out, r->account->acctid, strlen(r->account->acctid));
+    if (r->account->type == ACCOUNT_CCARD) OUTBUF_PUT_LIT(out, ",ccard,");
+    else OUTBUF_PUT_LIT(out, ",bank,");
+    csv_field(out, r->fitid, r->fitid_len);
+    outbuf_putc(out, ',');
+    csv_field(out, r->name, r->name_len);
+    outbuf_putc(out, ',');
+    csv_field(out, r->memo, r->memo_len);
+    outbuf_putc(out, ',');
+    if (r->parsed) record_amount(out, r);
+    else csv_field(out, r->raw_amount, r->raw_amount_len);
+    outbuf_putc(out, '\n');
+}
+
+/* Append a JSON string */
+void json_string(OutBuf *out, const char *p, size_t n) {
+    static const char hex[] = "0123456789abcdef";
+    const char *end = p + n;
+    outbuf_putc(out, '"');
+    while (p < end) {
+        const char *q = p;
+        while (q < end && (unsigned char)*q >= 0x20 && *q != '"' && *q != '\\') q++;
+        outbuf_put(out, p, (size_t)(q - p));
+        if (q == end) break;
+        unsigned char c = (unsigned char)*q;
+        if (c == '"' || c == '\\') {
+            char esc[2] = {'\\', (char)c};
+            outbuf_put(out, esc, 2);
+        } else {
+            char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+            outbuf_put(out, esc, 6);
+        }
+        p = q + 1;
+    }
+    outbuf_putc(out, '"');
+}
+
+/* JSON Lines: one object per record, ISO dates, amounts as numbers */
+static void jsonl_record(OutBuf *out, const Record *r, const ConvertOptions *) {
+    char date[DATE_TEXT_MAX];
+    OUTBUF_PUT_LIT(out, "{\"date\":");
+    json_string(out, date, record_date(r, &iso_date_layout, date));
+    OUTBUF_PUT_LIT(out, ",\"account\":");
+    json_string(out, r->account->acctid, strlen(r->account->acctid));
+    if (r->account->type == ACCOUNT_CCARD) OUTBUF_PUT_LIT(out, ",\"type\":\"ccard\"");
+    else OUTBUF_PUT_LIT(out, ",\"type\":\"bank\"");
+    if (r->fitid_len) {
+        OUTBUF_PUT_LIT(out, ",\"fitid\":");
+        json_string(out, r->fitid, r->fitid_len);
+    }
+    OUTBUF_PUT_LIT(out, ",\"payee\":");
+    json_string(out, r->name, r->name_len);
+    if (r->memo_len) {
+        OUTBUF_PUT_LIT(out, ",\"memo\":");
+        json_string(out, r->memo, r->memo_len);
+    }
+    OUTBUF_PUT_LIT(out, ",\"amount\":");
+    if (r->parsed) record_amount(out, r);
+    else json_string(out, r->raw_amount, r->raw_amount_len);
+    OUTBUF_PUT_LIT(out, "}\n");
+}
+
+/* ledger / hledger journal: a cleared entry per record, the FITID as its
+ * code, balanced against an Expenses or Income placeholder. A FITID that
+ * would end the code early goes in a comment instead. A record whose date
+ * or amount did not parse cannot be a valid entry; it is written
+ * commented out, so the rest of the journal still loads. */
+static void ledger_record(OutBuf *out, const Record *r, const ConvertOptions *) {
+    bool valid = r->dated && r->parsed;
+    bool code = r->fitid_len && !memchr(r->fitid, ')', r->fitid_len);
+    auto line = [out, valid](const char *indent, size_t n) {
+        if (!valid) OUTBUF_PUT_LIT(out, "; ");
+        outbuf_put(out, indent, n);
+    };
+    char date[DATE_TEXT_MAX];
+    if (!valid) OUTBUF_PUT_LIT(out, "; not converted, the date or amount did not parse:\n");
+    line("", 0);
+    outbuf_text(out, date, record_date(r, &iso_date_layout, date));
+    OUTBUF_PUT_LIT(out, " *");
+    if (code) {
+        OUTBUF_PUT_LIT(out, " (");
+        outbuf_text(out, r->fitid, r->fitid_len);
+        outbuf_putc(out, ')');
+    }
+    outbuf_putc(out, ' ');
+    if (r->name_len) outbuf_put(out, r->name, r->name_len);
+    else OUTBUF_PUT_LIT(out, "(unknown)");
+    outbuf_putc(out, '\n');
+    if (r->fitid_len && !code) {
+        line("    ; FITID: ", 13);
+        outbuf_text(out, r->fitid, r->fitid_len);
+        outbuf_putc(out, '\n');
+    }
+    if (r->memo_len) {
+        line("    ; ", 6);
+        outbuf_put(out, r->memo, r->memo_len);
+        outbuf_putc(out, '\n');
+    }
+    line("    ", 4);
+    if (r->account->type == ACCOUNT_CCARD) OUTBUF_PUT_LIT(out, "Liabilities:CreditCard");
+    else OUTBUF_PUT_LIT(out, "Assets:Bank");
+    if (r->account->acctid[0]) {
+        outbuf_putc(out, ':');
+        outbuf_text(out, r->account->acctid, strlen(r->account->acctid));
+    }
+    OUTBUF_PUT_LIT(out, "  ");
+    if (r->parsed) record_amount(out, r);
+    else outbuf_text(out, r->raw_amount, r->raw_amount_len);
+    outbuf_putc(out, '\n');
+    line("    ", 4);
+    if (r->parsed && r->cents > 0) OUTBUF_PUT_LIT(out, "Income:Unknown\n\n");
+    else OUTBUF_PUT_LIT(out, "Expenses:Unknown\n\n");
+}
+
+static const OutputFormat output_formats[FORMAT_COUNT] = {
+    { "qif",    ".qif",     NULL,      qif_section, qif_record    },
+    { "csv",    ".csv",     csv_begin, NULL,        csv_record    },
+    { "jsonl",  ".jsonl",   NULL,      NULL,        jsonl_record  },
+    { "ledger", ".journal", NULL,      NULL,        ledger_record }
+};
+
+/* Parse a comma-separated list of format names into a FORMAT_BIT() mask.
+ * Returns 1 on success, 0 for an unknown or empty name. */
+int output_format_parse(const char *list, unsigned *formats) {
+    unsigned mask = 0;
+    for (;;) {
+        const char *comma = strchr(list, ',');
+        size_t n = comma ? (size_t)(comma - list) : strlen(list);
+        int f = 0;
+        while (f < FORMAT_COUNT && !(strlen(output_formats[f].name) == n && fold_equal(list, output_formats[f].name, n))) f++;
+        if (f == FORMAT_COUNT) return 0;
+        mask |= FORMAT_BIT(f);
+        if (!comma) break;
+        list = comma + 1;
+    }
+    *formats = mask;
+    return 1;
+}
+
+const char *output_format_extension(int format) {
+    return output_formats[format].extension;
+}
+
+/* Start a document in every format */
+void outputs_begin(const OutputSet *out) {
+    for (int f = 0; f < FORMAT_COUNT; f++)
+        if (out->buf[f] && output_formats[f].begin) output_formats[f].begin(out->buf[f]);
+}
+
+/* Write r in every format of out, as it stands */
+void outputs_record(const OutputSet *out, const Record *r, const ConvertOptions *opts) {
+    for (int f = 0; f < FORMAT_COUNT; f++)
+        if (out->buf[f]) output_formats[f].record(out->buf[f], r, opts);
+}
+
+/* Start tracking a range. state is SECTION_NONE at the start of a
+ * document, SECTION_CONTINUED for a range cut from the middle of one. */
+void qif_begin(QifSection *sec, int state) {
+    sec->state = state;
+    sec->type = ACCOUNT_BANK;
+    sec->loose = false;
+    sec->acctid[0] = '\0';
+}
+
+/* Write the section header for the records that follow: that of the
+ * pending statement, or the plain one for records outside any statement
+ * at the start of the document.
+ */
+void section_open(QifSection *sec, const OutputSet *out) {
+    if (sec->state == SECTION_CONTINUED) {
+        sec->loose = true;
+        return;
+    }
+    if (sec->state != SECTION_NONE && sec->state != SECTION_PENDING) return;
+    for (int f = 0; f < FORMAT_COUNT; f++)
+        if (out->buf[f] && output_formats[f].section) output_formats[f].section(out->buf[f], sec);
+    sec->state = SECTION_OPEN;
+}
+
+/* Make sure a record written now lands in the right section */
+static inline void section_record(QifSection *sec, const OutputSet *out) {
+    if (sec->state != SECTION_OPEN) section_open(sec, out);
+}
+
+/* Read the ACCTID value whose start tag was just read into sec */
+static void section_acctid(OfxLexer *lx, QifSection *sec) {
+    FieldView v;
+    ofx_read_value(lx, lx->begin, &v);
+    const char *p = lx->begin + v.off;
+    while (v.len > 0 && isspace((unsigned char)*p)) { p++; v.len--; }
+    while (v.len > 0 && isspace((unsigned char)p[v.len - 1])) v.len--;
+    if (v.len > ACCTID_MAX) v.len = ACCTID_MAX;
+    memcpy(sec->acctid, p, v.len);
+    sec->acctid[v.len] = '\0';
+}
+
+/* Follow the statement structure through an event seen outside any
+ * <STMTTRN>. A statement without transactions still gets its section,
+ * written when it closes.
+ */
+static void section_event(OfxLexer *lx, const OfxEvent *ev, QifSection *sec, const OutputSet *out) {
+    if (ev->type == OFX_OPEN) {
+        int type;
+        if (OFX_TAG_IS(ev, "STMTRS")) type = ACCOUNT_BANK;
+        else if (OFX_TAG_IS(ev, "CCSTMTRS")) type = ACCOUNT_CCARD;
+        else {
+            /* the first ACCTID of a statement is its own, from
+               <BANKACCTFROM> or <CCACCTFROM> */
+            if (sec->state == SECTION_PENDING && !sec->acctid[0] && OFX_TAG_IS(ev, "ACCTID"))
+                section_acctid(lx, sec);
+            return;
+        }
+        if (sec->state == SECTION_PENDING) section_open(sec, out);
+        sec->state = SECTION_PENDING;
+        sec->type = type;
+        sec->acctid[0] = '\0';
+    } else if (ev->type == OFX_CLOSE && sec->state == SECTION_PENDING &&
+               (OFX_TAG_IS(ev, "STMTRS") || OFX_TAG_IS(ev, "CCSTMTRS"))) {
+        section_open(sec, out);
+    }
+}
+
+/* Finish a range: write the header of a statement still pending. At the
+ * end of a document that wrote nothing, write the plain header so a QIF
+ * output is still a QIF file.
+ */
+void qif_end(QifSection *sec, const OutputSet *out) {
+    if (sec->state == SECTION_PENDING || sec->state == SECTION_NONE) section_open(sec, out);
+}
+
+/* Length of the first max bytes of UTF-8 text p[0, n), not splitting a
+ * character */
+size_t utf8_prefix(const char *p, size_t n, size_t max) {
+    if (n <= max) return n;
+    while (max > 0 && ((unsigned char)p[max] & 0xC0) == 0x80) max--;
+    return max;
+}
+
+/* Write one transaction in every format of out, add it to out->summary,
+ * pass it to out->collect and, if listing is not NULL, write a one-line
+ * summary of it to listing. NAME and MEMO are converted once, into
+ * scratch, for all formats.
+ * Returns 1 if a record was written, 0 if the transaction was skipped.
+ */
+static int convert_stmttrn(const OutputSet *out, OutBuf *listing, OutBuf *scratch,
+                           const Transaction *t, const ConvertOptions *opts,
+                           QifSection *sec, ConvertCounts *counts)
+{
+    FieldView dtposted = field_trim(t, t->dtposted);
+    FieldView trnamt = field_trim(t, t->trnamt);
+    FieldView fitid = field_trim(t, t->fitid);
+    FieldView name = field_trim(t, t->name);
+    FieldView memo = field_trim(t, t->memo);
+
+    /* require at least an amount; skip if none */
+    if (trnamt.len == 0) {
+        ++counts->skipped;
+        return 0;
+    }
+    /* a transaction without a FITID cannot be recognised later,
+       so it is always written */
+    if (opts->seen && fitid.len
+        && !seen_check(opts->seen, sec->acctid, strlen(sec->acctid), field_ptr(t, fitid), fitid.len)) {
+        ++counts->duplicates;
+        return 0;
+    }
+
+    Record r;
+    r.raw_date = field_ptr(t, dtposted);
+    r.dated = ofx_parse_datetime(r.raw_date, dtposted.len, &r.dt) != 0;
+    r.raw_date_len = dtposted.len < DATE_RAW_MAX ? dtposted.len : DATE_RAW_MAX;
+    r.raw_amount = field_ptr(t, trnamt);
+    r.raw_amount_len = trnamt.len;
+    r.parsed = amount_parse(r.raw_amount, trnamt.len, &r.cents) != 0;
+    r.fitid = field_ptr(t, fitid);
+    r.fitid_len = fitid.len;
+    r.account = sec;
+
+    scratch->len = 0;
+    outbuf_field(scratch, field_ptr(t, name), name.len, opts);
+    r.name_len = scratch->len;
+    if (memo.len && !opts->memo) counts->memos_excluded = true;
+    if (memo.len && opts->memo) outbuf_field(scratch, field_ptr(t, memo), memo.len, opts);
+    r.memo_len = scratch->len - r.name_len;
+    r.name = scratch->data;
+    r.memo = scratch->data + r.name_len;
+
+    section_record(sec, out);
+    for (int f = 0; f < FORMAT_COUNT; f++)
+        if (out->buf[f]) output_formats[f].record(out->buf[f], &r, opts);
+    if (out->summary) summary_add(out->summary, &r);
+    if (out->collect) out->collect(out->collect_user, &r);
+
+    ++counts->transactions;
+
+    if (listing)
+    {
+        char date[DATE_TEXT_MAX];
+        outbuf_put(listing, date, record_date(&r, opts->date_layout, date));
+        outbuf_putc(listing, '\t');
+        outbuf_put(listing, r.name, utf8_prefix(r.name, r.name_len, 16));
+        outbuf_putc(listing, '\t');
+        if (memo.len && !opts->memo) {
+            OUTBUF_PUT_LIT(listing, "EXCLUDED");
+        } else {
+            outbuf_put(listing, r.memo, utf8_prefix(r.memo, r.memo_len, 8));
+        }
+        OUTBUF_PUT_LIT(listing, "\t$");
+        record_amount(listing, &r);
+        outbuf_putc(listing, '\n');
+    }
+    return 1;
+}
+
+/* Kept out of line so the untimed loop stays as tight as before */
+__attribute__((noinline))
+static void convert_range_timed(const char *begin, const char *end, const ConvertOptions *opts,
+                                QifSection *sec, const OutputSet *out, OutBuf *listing,
+                                OutBuf *scratch, ConvertCounts *counts);
+
+/* Convert every transaction in [begin, end), starting a QIF section for
+ * each statement met on the way. Reentrant: all state lives in the
+ * arguments, so workers may run it concurrently on disjoint ranges with
+ * their own sections, buffers and counts.
+ * Returns 1 on success, 0 if out of memory.
+ */
+int convert_range(const char *begin, const char *end, const ConvertOptions *opts,
+                  QifSection *sec, const OutputSet *out, OutBuf *listing, ConvertCounts *counts)
+{
+    OutBuf scratch;
+    if (!outbuf_init(&scratch, -1, 1024)) return 0;
+    if (opts->stats) {
+        convert_range_timed(begin, end, opts, sec, out, listing, &scratch, counts);
+        outbuf_free(&scratch);
+        return 1;
+    }
+    Transaction t;
+    OfxLexer lx;
+    OfxEvent ev;
+    ofx_lex_init(&lx, begin, end);
+    while (ofx_lex_next(&lx, &ev) != OFX_EOF) {
+        if (ev.type != OFX_OPEN || !OFX_TAG_IS(&ev, "STMTTRN")) {
+            section_event(&lx, &ev, sec, out);
+            continue;
+        }
+        if (!ofx_read_stmttrn(&lx, &t)) break;
+        convert_stmttrn(out, listing, &scratch, &t, opts, sec, counts);
+    }
+    outbuf_free(&scratch);
+    return 1;
+}
+
+/* Give the scan, extract and format phases their share of cpu seconds,
+ * in proportion to the wall time each gained since before. */
+static void phases_share_cpu(PhaseTimes *pt, const PhaseTimes *before, double cpu) {
+    double wall[PHASE_COUNT], total = 0;
+    for (int k = PHASE_SCAN; k <= PHASE_FORMAT; k++) {
+        wall[k] = pt->wall[k] - before->wall[k];
+        total += wall[k];
+    }
+    if (total <= 0) return;
+    for (int k = PHASE_SCAN; k <= PHASE_FORMAT; k++) pt->cpu[k] += cpu * wall[k] / total;
+}
+
+/* convert_range() with the time of every phase added to counts->phases.
+ * Output flushed while formatting is counted as write time. */
+static void convert_range_timed(const char *begin, const char *end, const ConvertOptions *opts,
+                                QifSection *sec, const OutputSet *out, OutBuf *listing,
+                                OutBuf *scratch, ConvertCounts *counts)
+{
+    PhaseTimes *pt = &counts->phases;
+    PhaseTimes before = *pt;
+    double cpu = thread_cpu_seconds();
+    Transaction t;
+    OfxLexer lx;
+    OfxEvent ev;
+    ofx_lex_init(&lx, begin, end);
+
+    double t0 = now_seconds();
+    for (;;) {
+        bool found = false;
+        while (!found && ofx_lex_next(&lx, &ev) != OFX_EOF) {
+            found = ev.type == OFX_OPEN && OFX_TAG_IS(&ev, "STMTTRN");
+            if (!found) section_event(&lx, &ev, sec, out);
+        }
+        double t1 = now_seconds();
+        pt->wall[PHASE_SCAN] += t1 - t0;
+        if (!found) break;
+
+        int complete = ofx_read_stmttrn(&lx, &t);
+        double t2 = now_seconds();
+        pt->wall[PHASE_EXTRACT] += t2 - t1;
+        if (!complete) break;
+
+        double written = pt->wall[PHASE_WRITE];
+        convert_stmttrn(out, listing, scratch, &t, opts, sec, counts);
+        t0 = now_seconds();
+        pt->wall[PHASE_FORMAT] += t0 - t2 - (pt->wall[PHASE_WRITE] - written);
+    }
+    cpu = thread_cpu_seconds() - cpu - (pt->cpu[PHASE_WRITE] - before.cpu[PHASE_WRITE]);
+    phases_share_cpu(pt, &before, cpu);
+}
+
+/* Smallest piece of input worth handing to a separate thread */
+#define PARALLEL_MIN_PIECE (1024 * 1024)
+
+static const CaseSearcher stmtrs_search = make_case_searcher("STMTRS");
+
+/* Find the last <STMTRS> or <CCSTMTRS> start tag in [p, end); from is
+ * where the document starts. Returns NULL if there is none. */
+static const char *find_last_statement(const char *from, const char *p, const char *end) {
+    const char *last = NULL;
+    for (;;) {
+        const char *q = case_search(&stmtrs_search, p, (size_t)(end - p));
+        if (!q) return last;
+        p = q + stmtrs_search.len;
+        if (p < end && *p != '>' && !isspace((unsigned char)*p)) continue;
+        if (q - from >= 1 && q[-1] == '<') last = q - 1;
+        else if (q - from >= 3 && q[-3] == '<' && fold_equal(q - 2, "CC", 2)) last = q - 3;
+    }
+}
+
+/* Read the type and ACCTID of the statement starting at tag into sec */
+static void statement_account(const char *tag, const char *end, QifSection *sec) {
+    static const OutputSet none = {};
+    QifSection found;
+    OfxLexer lx;
+    OfxEvent ev;
+    qif_begin(&found, SECTION_NONE);
+    ofx_lex_init(&lx, tag, end);
+    while (ofx_lex_next(&lx, &ev) != OFX_EOF) {
+        if (ev.type == OFX_OPEN && OFX_TAG_IS(&ev, "STMTTRN")) break;
+        section_event(&lx, &ev, &found, &none);
+        if (found.acctid[0] || found.state == SECTION_OPEN) break;
+    }
+    sec->type = found.type;
+    memcpy(sec->acctid, found.acctid, sizeof sec->acctid);
+}
+
+/* Convert the document [begin, end) on up to nthreads threads. The range
+ * is cut at <STMTTRN> tags into roughly equal pieces, each worker formats
+ * its piece into private in-memory buffers, and the buffers are appended
+ * to out (and listing) in input order, so the result matches
+ * convert_range(). A piece cannot know the section its first records
+ * belong to; that is settled while appending, from the pieces before it.
+ * Formats that name the account in every record need it from the start,
+ * so for them each piece first looks for its last statement, and the
+ * pieces after it begin in that statement's account.
+ * Returns 1 on success, 0 if a worker ran out of memory.
+ */
+int convert_parallel(const char *begin, const char *end, int nthreads,
+                     const ConvertOptions *opts, const OutputSet *out, OutBuf *listing,
+                     ConvertCounts *counts)
+{
+    struct Piece {
+        const char    *begin, *end;
+        const char    *statement;   /* last statement tag in the piece */
+        QifSection     sec;
+        OutBuf         out[FORMAT_COUNT], listing;
+        OutputSet      outs;
+        ConvertCounts  counts;
+        bool           converted;
+    };
+    QifSection sec;
+    size_t len = (size_t)(end - begin);
+    if ((size_t)nthreads > len / PARALLEL_MIN_PIECE) nthreads = (int)(len / PARALLEL_MIN_PIECE);
+    if (opts->seen || out->collect) nthreads = 1;
+    qif_begin(&sec, SECTION_NONE);
+    outputs_begin(out);
+    if (nthreads <= 1) {
+        if (!convert_range(begin, end, opts, &sec, out, listing, counts)) return 0;
+        qif_end(&sec, out);
+        return 1;
+    }
+
+    std::vector<Piece> pieces;
+    const char *cut = begin;
+    for (int k = 1; k <= nthreads && cut < end; k++) {
+        const char *next = (k == nthreads) ? end : find_stmttrn_tag(begin + len / nthreads * k, end);
+        if (next <= cut) continue;
+        Piece piece;
+        piece.begin = cut;
+        piece.end = next;
+        piece.statement = NULL;
+        qif_begin(&piece.sec, SECTION_CONTINUED);
+        piece.counts = ConvertCounts();
+        piece.converted = false;
+        pieces.push_back(piece);
+        cut = next;
+    }
+
+    if (opts->formats & ~FORMAT_BIT(FORMAT_QIF)) {
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i + 1 < pieces.size(); i++) {
+            Piece *piece = &pieces[i];
+            workers.emplace_back([piece, begin] {
+                piece->statement = find_last_statement(begin, piece->begin, piece->end);
+            });
+        }
+        for (std::thread &w : workers) w.join();
+        const char *statement = NULL;
+        for (size_t i = 1; i < pieces.size(); i++) {
+            if (pieces[i - 1].statement) statement = pieces[i - 1].statement;
+            if (statement) statement_account(statement, end, &pieces[i].sec);
+        }
+    }
+
+    bool ok = true;
+    for (Piece &piece : pieces) {
+        piece.outs.collect = NULL;
+        piece.outs.summary = out->summary ? summary_new() : NULL;
+        if (out->summary && !piece.outs.summary) ok = false;
+        size_t estimate = outbuf_estimate((size_t)(piece.end - piece.begin));
+        for (int f = 0; f < FORMAT_COUNT; f++) {
+            piece.outs.buf[f] = NULL;
+            if (!out->buf[f]) continue;
+            piece.outs.buf[f] = &piece.out[f];
+            if (!outbuf_init(&piece.out[f], -1, estimate)) ok = false;
+        }
+        if (!outbuf_init(&piece.listing, -1, listing ? OUTBUF_MIN : 1)) ok = false;
+    }
+
+    if (ok) {
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < pieces.size(); i++) {
+            Piece *piece = &pieces[i];
+            workers.emplace_back([piece, opts, listing] {
+                piece->converted = convert_range(piece->begin, piece->end, opts, &piece->sec,
+                                                 &piece->outs, listing ? &piece->listing : NULL,
+                                                 &piece->counts);
+                qif_end(&piece->sec, &piece->outs);
+            });
+        }
+        Piece *first = &pieces[0];
+        first->converted = convert_range(first->begin, first->end, opts, &first->sec, &first->outs,
+                                         listing ? &first->listing : NULL, &first->counts);
+        qif_end(&first->sec, &first->outs);
+        for (std::thread &w : workers) w.join();
+    }
+
+    for (Piece &piece : pieces) {
+        bool done = ok && piece.converted && !piece.listing.error;
+        for (int f = 0; f < FORMAT_COUNT; f++)
+            if (piece.outs.buf[f] && piece.out[f].error) done = false;
+        if (done) {
+            /* records ahead of the piece's first statement continue the
+               section before it, if there is one */
+            if (piece.sec.loose) section_record(&sec, out);
+            if (piece.sec.state == SECTION_OPEN) sec.state = SECTION_OPEN;
+            for (int f = 0; f < FORMAT_COUNT; f++)
+                if (out->buf[f]) outbuf_put(out->buf[f], piece.out[f].data, piece.out[f].len);
+            if (listing) outbuf_put(listing, piece.listing.data, piece.listing.len);
+            if (out->summary) summary_merge(out->summary, piece.outs.summary);
+            counts_add(counts, &piece.counts);
+        } else {
+            ok = false;
+        }
+        for (int f = 0; f < FORMAT_COUNT; f++)
+            if (piece.outs.buf[f]) outbuf_free(&piece.out[f]);
+        outbuf_free(&piece.listing);
+        summary_free(piece.outs.summary);
+    }
+    if (ok) qif_end(&sec, out);
+    return ok;
+}
+
+/* Convert input read sequentially in STREAM_CHUNK pieces.
+ * The window is walked up to its last '<', the one tag that may still be
+ * cut off; <STMTTRN> blocks are converted as soon as their end tag is
+ * before that point, and only an unfinished block (or that last tag) is
+ * carried over to the next read. Memory therefore stays at a few chunks whatever
+ * the input size; the window grows only if a single block is larger than
+ * it.
+ * Returns 1 on success, 0 on read or allocation error.
+ */
+int convert_stream(FILE *fin, const OutputSet *out, OutBuf *listing,
+                   const ConvertOptions *base, ConvertCounts *counts)
+{
+    ConvertOptions input_opts;
+    const ConvertOptions *opts = NULL;  /* set once the header has been read */
+    QifSection sec;
+    size_t cap = 2 * STREAM_CHUNK;
+    size_t fill = 0;
+    bool eof = false;
+    char *win = (char *)malloc(cap + 1);
+    OutBuf scratch;
+    Transaction t;
+    PhaseTimes *pt = base->stats ? &counts->phases : NULL;
+    PhaseTimes before = {};
+    double cpu = 0;
+    if (!win) return 0;
+    if (!outbuf_init(&scratch, -1, 1024)) {
+        free(win);
+        return 0;
+    }
+    if (pt) {
+        before = *pt;
+        cpu = thread_cpu_seconds();
+    }
+    qif_begin(&sec, SECTION_NONE);
+    outputs_begin(out);
+
+    while (!eof) {
+        if (cap - fill < STREAM_CHUNK) {
+            char *nw = (char *)realloc(win, cap * 2 + 1);
+            if (!nw) { free(win); outbuf_free(&scratch); return 0; }
+            win = nw;
+            cap *= 2;
+        }
+        double t0 = 0, c0 = 0;
+        if (pt) {
+            t0 = now_seconds();
+            c0 = thread_cpu_seconds();
+        }
+        size_t n = fread(win + fill, 1, STREAM_CHUNK, fin);
+        if (pt) {
+            pt->wall[PHASE_READ] += now_seconds() - t0;
+            pt->cpu[PHASE_READ] += thread_cpu_seconds() - c0;
+        }
+        if (n < STREAM_CHUNK) {
+            if (ferror(fin)) { free(win); outbuf_free(&scratch); return 0; }
+            eof = true;
+        }
+        fill += n;
+        win[fill] = '\0';
+        if (!opts) {
+            convert_options_for_input(base, win, fill, &input_opts);
+            opts = &input_opts;
+        }
+
+        const char *end = win + fill;
+        const char *limit = eof ? NULL : (const char *)memrchr(win, '<', fill);
+        if (!limit) limit = end;
+        const char *keep = NULL;
+        OfxLexer lx;
+        OfxEvent ev;
+        ofx_lex_init(&lx, win, limit);
+        if (pt) t0 = now_seconds();
+        while (ofx_lex_next(&lx, &ev) != OFX_EOF) {
+            if (ev.type != OFX_OPEN || !OFX_TAG_IS(&ev, "STMTTRN")) {
+                section_event(&lx, &ev, &sec, out);
+                continue;
+            }
+            const char *tag = ev.ptr - 1;
+            double t1 = 0, t2 = 0, written = 0;
+            if (pt) {
+                t1 = now_seconds();
+                pt->wall[PHASE_SCAN] += t1 - t0;
+            }
+            int complete = ofx_read_stmttrn(&lx, &t);
+            if (pt) {
+                t2 = now_seconds();
+                pt->wall[PHASE_EXTRACT] += t2 - t1;
+                written = pt->wall[PHASE_WRITE];
+                t0 = t2;
+            }
+            if (!complete) {
+                /* the end tag is not in the window yet: read the block
+                   again once more input is in */
+                if (!eof) keep = tag;
+                break;
+            }
+            convert_stmttrn(out, listing, &scratch, &t, opts, &sec, counts);
+            if (pt) {
+                t0 = now_seconds();
+                pt->wall[PHASE_FORMAT] += t0 - t2 - (pt->wall[PHASE_WRITE] - written);
+            }
+        }
+        if (pt) pt->wall[PHASE_SCAN] += now_seconds() - t0;
+
+        if (!keep) keep = lx.p;
+        fill = keep < end ? (size_t)(end - keep) : 0;
+        memmove(win, keep, fill);
+    }
+    free(win);
+    outbuf_free(&scratch);
+    qif_end(&sec, out);
+    if (pt) {
+        cpu = thread_cpu_seconds() - cpu - (pt->cpu[PHASE_READ] - before.cpu[PHASE_READ])
+              - (pt->cpu[PHASE_WRITE] - before.cpu[PHASE_WRITE]);
+        phases_share_cpu(pt, &before, cpu);
+    }
+    return 1;
+}
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+double thread_cpu_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Add the totals in from to those in to */
+void counts_add(ConvertCounts *to, const ConvertCounts *from) {
+    to->transactions += from->transactions;
+    to->skipped += from->skipped;
+    to->duplicates += from->duplicates;
+    if (from->memos_excluded) to->memos_excluded = true;
+    for (int k = 0; k < PHASE_COUNT; k++) {
+        to->phases.wall[k] += from->phases.wall[k];
+        to->phases.cpu[k] += from->phases.cpu[k];
+    }
+}
+
+/*
+ * Seen index.
+ *
+ * The file is a SeenHeader followed by a power-of-two array of 64-bit
+ * hashes of (ACCTID, FITID), open addressing with linear probing, 0 for
+ * an empty slot. It is mapped, not read, so a lookup touches a page or
+ * two however long the history. Entries are never removed; the table is
+ * rebuilt at twice the size in a new file, renamed over the old one,
+ * whenever a commit would fill it past half.
+ */
+#define SEEN_MAGIC      "QXSEEN1\n"
+#define SEEN_MIN_SLOTS  ((uint64_t)1 << 16)
+
+typedef struct {
+    char     magic[8];
+    uint64_t capacity;      /* slots, a power of two */
+    uint64_t count;         /* slots in use */
+    uint64_t reserved[5];
+} SeenHeader;
+
+struct SeenIndex {
+    std::string           path;
+    int                   fd;
+    SeenHeader           *head;     /* the mapping; the slots follow */
+    size_t                map_len;
+    std::vector<uint64_t> pending;  /* new this conversion, in order */
+    std::vector<uint64_t> pending_set;  /* open-addressing set of pending */
+};
+
+static uint64_t *seen_slots(SeenHeader *head) {
+    return (uint64_t *)(head + 1);
+}
+
+/* FNV-1a over account, a separator and FITID, then the MurmurHash3
+ * finaliser so that the low bits used as the slot index are well mixed */
+uint64_t seen_hash(const char *acct, size_t acct_len, const char *fitid, size_t fitid_len) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < acct_len; i++) h = (h ^ (unsigned char)acct[i]) * 0x100000001b3ull;
+    h = (h ^ 0xFF) * 0x100000001b3ull;
+    for (size_t i = 0; i < fitid_len; i++) h = (h ^ (unsigned char)fitid[i]) * 0x100000001b3ull;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h ? h : 1;
+}
+
+/* Slot holding h, or the empty slot where it belongs */
+uint64_t *seen_probe(uint64_t *slots, uint64_t capacity, uint64_t h) {
+    uint64_t mask = capacity - 1;
+    for (uint64_t i = h & mask; ; i = (i + 1) & mask) {
+        if (slots[i] == h || slots[i] == 0) return &slots[i];
+    }
+}
+
+/* Map the index file open on fd, creating an empty table in it if it is
+ * new. Returns the mapping, or NULL if the file is not an index. */
+static SeenHeader *seen_map(int fd, size_t *map_len) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return NULL;
+    if (st.st_size == 0) {
+        SeenHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, SEEN_MAGIC, 8);
+        h.capacity = SEEN_MIN_SLOTS;
+        if (ftruncate(fd, (off_t)(sizeof(h) + SEEN_MIN_SLOTS * 8)) != 0) return NULL;
+        if (pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) return NULL;
+        st.st_size = (off_t)(sizeof(h) + SEEN_MIN_SLOTS * 8);
+    }
+    SeenHeader h;
+    if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || memcmp(h.magic, SEEN_MAGIC, 8) != 0
+        || h.capacity < 2 || (h.capacity & (h.capacity - 1)) != 0
+        || (uint64_t)st.st_size != sizeof(h) + h.capacity * 8) {
+        errno = EINVAL;
+        return NULL;
+    }
+    void *m = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) return NULL;
+    *map_len = (size_t)st.st_size;
+    return (SeenHeader *)m;
+}
+
+/* Open (creating it if needed) and lock the seen index at path.
+ * Blocks while another process holds it. Returns NULL with errno set if
+ * it cannot be opened or is not an index file.
+ */
+SeenIndex *seen_open(const char *path) {
+    int fd;
+    for (;;) {
+        fd = open(path, O_RDWR | O_CREAT, 0666);
+        if (fd < 0) return NULL;
+        if (flock(fd, LOCK_EX) != 0) {
+            close(fd);
+            return NULL;
+        }
+        /* a commit that grew the table may have replaced the file
+           while we waited for the lock */
+        struct stat fst, pst;
+        if (fstat(fd, &fst) == 0 && stat(path, &pst) == 0
+            && fst.st_dev == pst.st_dev && fst.st_ino == pst.st_ino)
+            break;
+        close(fd);
+    }
+
+    size_t map_len;
+    SeenHeader *head = seen_map(fd, &map_len);
+    if (!head) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        return NULL;
+    }
+    SeenIndex *si = new SeenIndex;
+    si->path = path;
+    si->fd = fd;
+    si->head = head;
+    si->map_len = map_len;
+    return si;
+}
+
+/* Returns 1 if (acct, fitid) is new, recording it as pending, or 0 if the
+ * index or the current conversion has it already */
+int seen_check(SeenIndex *si, const char *acct, size_t acct_len, const char *fitid, size_t fitid_len) {
+    uint64_t h = seen_hash(acct, acct_len, fitid, fitid_len);
+    if (*seen_probe(seen_slots(si->head), si->head->capacity, h) == h) return 0;
+
+    std::vector<uint64_t> &set = si->pending_set;
+    if (set.size() < 2 * (si->pending.size() + 1)) {
+        std::vector<uint64_t> grown(set.empty() ? 1024 : set.size() * 2, 0);
+        for (uint64_t p : si->pending) *seen_probe(grown.data(), grown.size(), p) = p;
+        set.swap(grown);
+    }
+    uint64_t *slot = seen_probe(set.data(), set.size(), h);
+    if (*slot == h) return 0;
+    *slot = h;
+    si->pending.push_back(h);
+    return 1;
+}
+
+/* Rebuild the table with room for need entries in a new file and rename
+ * it over the index. The new file is locked before it becomes visible.
+ * Returns 1 on success, 0 on error (the index is then unchanged).
+ */
+static int seen_grow(SeenIndex *si, uint64_t need) {
+    uint64_t capacity = si->head->capacity;
+    while (capacity < 2 * need) capacity *= 2;
+
+    std::string tmp = si->path + ".tmp";
+    int fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return 0;
+    size_t map_len = sizeof(SeenHeader) + capacity * 8;
+    void *m = MAP_FAILED;
+    if (flock(fd, LOCK_EX) == 0 && ftruncate(fd, (off_t)map_len) == 0)
+        m = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        close(fd);
+        unlink(tmp.c_str());
+        return 0;
+    }
+
+    SeenHeader *head = (SeenHeader *)m;
+    memcpy(head->magic, SEEN_MAGIC, 8);
+    head->capacity = capacity;
+    head->count = si->head->count;
+    const uint64_t *old = seen_slots(si->head);
+    uint64_t *slots = seen_slots(head);
+    for (uint64_t i = 0; i < si->head->capacity; i++)
+        if (old[i]) *seen_probe(slots, capacity, old[i]) = old[i];
+
+    if (fsync(fd) != 0 || rename(tmp.c_str(), si->path.c_str()) != 0) {
+        munmap(m, map_len);
+        close(fd);
+        unlink(tmp.c_str());
+        return 0;
+    }
+    munmap(si->head, si->map_len);
+    close(si->fd);
+    si->fd = fd;
+    si->head = head;
+    si->map_len = map_len;
+    return 1;
+}
+
+/* Add the pending pairs to the index. Returns 1 on success, 0 if the
+ * table could not be grown to hold them; they stay pending then. */
+int seen_commit(SeenIndex *si) {
+    uint64_t need = si->head->count + si->pending.size();
+    if (2 * need > si->head->capacity && !seen_grow(si, need)) return 0;
+    uint64_t *slots = seen_slots(si->head);
+    for (uint64_t h : si->pending) *seen_probe(slots, si->head->capacity, h) = h;
+    si->head->count = need;
+    seen_discard(si);
+    return 1;
+}
+
+/* Forget the pending pairs */
+void seen_discard(SeenIndex *si) {
+    si->pending.clear();
+    si->pending_set.clear();
+}
+
+/* Unmap and unlock the index; pending pairs are not added */
+void seen_close(SeenIndex *si) {
+    if (!si) return;
+    munmap(si->head, si->map_len);
+    close(si->fd);
+    delete si;
+}
+
+/*
+ * Stored text and interned names.
+ *
+ * Text kept past the parse of a transaction is copied into an arena as
+ * length-prefixed strings. Names that repeat (payees) are interned, so
+ * each is stored once and compares as an integer.
+ */
+
+/* Copy p[0, n) into a as a length-prefixed string: NULL if n is 0 or on
+ * allocation failure (which sets *error) */
+const char *text_put(Arena *a, bool *error, const char *p, size_t n) {
+    if (n == 0) return NULL;
+    char *s = (char *)arena_alloc(a, sizeof(uint32_t) + n);
+    if (!s) {
+        *error = true;
+        return NULL;
+    }
+    uint32_t len = (uint32_t)n;
+    memcpy(s, &len, sizeof(len));
+    memcpy(s + sizeof(len), p, n);
+    return s;
+}
+
+size_t text_len(const char *s) {
+    uint32_t len = 0;
+    if (s) memcpy(&len, s, sizeof(len));
+    return len;
+}
+
+const char *text_ptr(const char *s) {
+    return s ? s + sizeof(uint32_t) : "";
+}
+
+/* Empty ix, keeping its slots */
+void names_clear(NameIndex *ix) {
+    ix->names.clear();
+    std::fill(ix->slots.begin(), ix->slots.end(), 0);
+}
+
+/* Index of the name p[0, n) in ix, its text copied into a if new.
+ * Throws std::bad_alloc. */
+uint32_t names_intern(NameIndex *ix, Arena *a, bool *error, const char *p, size_t n) {
+    uint64_t tag = seen_hash("", 0, p, n) >> 32 << 32;
+    if (ix->slots.size() < 2 * (ix->names.size() + 1)) {
+        std::vector<uint64_t> grown(ix->slots.empty() ? 1024 : ix->slots.size() * 2, 0);
+        size_t mask = grown.size() - 1;
+        for (uint64_t slot : ix->slots) {
+            if (!slot) continue;
+            size_t k = (slot >> 32) & mask;
+            while (grown[k]) k = (k + 1) & mask;
+            grown[k] = slot;
+        }
+        ix->slots.swap(grown);
+    }
+    size_t mask = ix->slots.size() - 1;
+    size_t k = (tag >> 32) & mask;
+    for (uint64_t slot; (slot = ix->slots[k]) != 0; k = (k + 1) & mask) {
+        if ((slot & ~(uint64_t)UINT32_MAX) != tag) continue;
+        const char *s = ix->names[(uint32_t)slot - 1];
+        if (text_len(s) == n && memcmp(text_ptr(s), p, n) == 0) return (uint32_t)slot - 1;
+    }
+    uint32_t id = (uint32_t)ix->names.size();
+    ix->names.push_back(text_put(a, error, p, n));
+    ix->slots[k] = tag | (id + 1);
+    return id;
+}
+
+/*
+ * Summary.
+ *
+ * Totals of the records written, added up as they are written. Each
+ * piece of a parallel conversion fills its own, merged afterwards in
+ * order, so gathering them neither re-reads the input nor holds back the
+ * threads. Only debits go through the payee index, by NAME as written.
+ */
+
+Summary *summary_new(void) {
+    Summary *s = new (std::nothrow) Summary;
+    if (!s) return NULL;
+    s->transactions = s->undated = s->unparsed = 0;
+    s->first = INT64_MAX;
+    s->last = INT64_MIN;
+    memset(&s->total, 0, sizeof(s->total));
+    s->month = 0;
+    arena_init(&s->arena);
+    s->error = false;
+    return s;
+}
+
+void summary_free(Summary *s) {
+    if (!s) return;
+    arena_free(&s->arena);
+    delete s;
+}
+
+int summary_failed(const Summary *s) {
+    return s->error;
+}
+
+/* Totals of month (YYYYMM), added if new. Records mostly come in date
+ * order, so the month last used is tried first. Throws std::bad_alloc. */
+static SummaryMonth *summary_month(Summary *s, int32_t month) {
+    if (s->month < s->months.size() && s->months[s->month].month == month) return &s->months[s->month];
+    auto it = std::lower_bound(s->months.begin(), s->months.end(), month,
+                               [](const SummaryMonth &m, int32_t key) { return m.month < key; });
+    if (it == s->months.end() || it->month != month) {
+        SummaryMonth m;
+        memset(&m, 0, sizeof(m));
+        m.month = month;
+        it = s->months.insert(it, m);
+    }
+    s->month = (size_t)(it - s->months.begin());
+    return &*it;
+}
+
+static void summary_count(SummaryMonth *m, int64_t cents) {
+    if (cents > 0) {
+        m->credits++;
+        m->credit_cents += cents;
+    } else if (cents < 0) {
+        m->debits++;
+        m->debit_cents += cents;
+    }
+}
+
+/* Add the debits of a payee */
+static void summary_spend(Summary *s, const char *name, size_t len, int64_t cents, int payments) {
+    uint32_t id = names_intern(&s->payees, &s->arena, &s->error, name, len);
+    if (id == s->spend.size()) s->spend.push_back(SummaryPayee());
+    s->spend[id].spend += cents;
+    s->spend[id].payments += payments;
+}
+
+void summary_add(Summary *s, const Record *r) {
+    s->transactions++;
+    if (r->dated) {
+        int64_t key = record_key(r);
+        if (key < s->first) {
+            s->first = key;
+            s->first_dt = r->dt;
+        }
+        if (key > s->last) {
+            s->last = key;
+            s->last_dt = r->dt;
+        }
+    } else {
+        s->undated++;
+    }
+    if (!r->parsed) {
+        s->unparsed++;
+        return;
+    }
+    try {
+        summary_count(&s->total, r->cents);
+        if (r->dated) summary_count(summary_month(s, r->dt.year * 100 + r->dt.month), r->cents);
+        if (r->cents < 0) summary_spend(s, r->name, r->name_len, -r->cents, 1);
+    } catch (const std::bad_alloc &) {
+        s->error = true;
+    }
+}
+
+static void month_add(SummaryMonth *to, const SummaryMonth *from) {
+    to->credits += from->credits;
+    to->debits += from->debits;
+    to->credit_cents += from->credit_cents;
+    to->debit_cents += from->debit_cents;
+}
+
+/* Add the totals of from to to */
+void summary_merge(Summary *to, const Summary *from) {
+    to->transactions += from->transactions;
+    to->undated += from->undated;
+    to->unparsed += from->unparsed;
+    if (from->first < to->first) {
+        to->first = from->first;
+        to->first_dt = from->first_dt;
+    }
+    if (from->last > to->last) {
+        to->last = from->last;
+        to->last_dt = from->last_dt;
+    }
+    month_add(&to->total, &from->total);
+    if (from->error) to->error = true;
+    try {
+        for (const SummaryMonth &m : from->months) month_add(summary_month(to, m.month), &m);
+        for (size_t id = 0; id < from->spend.size(); id++) {
+            const char *name = from->payees.names[id];
+            summary_spend(to, text_ptr(name), text_len(name), from->spend[id].spend,
+                          from->spend[id].payments);
+        }
+    } catch (const std::bad_alloc &) {
+        to->error = true;
+    }
+}
+
+} /* namespace qxf2qif::detail */
+
+/*
+ * C interface (qxf2qif.h)
+ */
+
+using namespace qxf2qif::detail;
+
+struct qxf2qif_converter {
+    int             threads;
+    int             format;     /* FORMAT_* written */
+    DateLayout      layout;
+    ConvertOptions  convert;    /* built from the qxf2qif_options */
+    ConvertCounts   counts;     /* totals of the last conversion */
+};
+
+void qxf2qif_options_init(qxf2qif_options *opts) {
+    opts->memo = 0;
+    opts->threads = 1;
+    opts->date_format = NULL;
+    opts->output_charset = NULL;
+    opts->format = NULL;
+}
+
+qxf2qif_converter *qxf2qif_new(const qxf2qif_options *opts) {
+    qxf2qif_options defaults;
+    if (!opts) {
+        qxf2qif_options_init(&defaults);
+        opts = &defaults;
+    }
+    qxf2qif_converter *cv = (qxf2qif_converter *)malloc(sizeof(*cv));
+    if (!cv) return NULL;
+    cv->threads = opts->threads;
+    cv->format = FORMAT_QIF;
+    cv->convert.formats = FORMAT_BIT(FORMAT_QIF);
+    cv->convert.memo = opts->memo != 0;
+    cv->convert.stats = false;
+    cv->convert.date_layout = NULL;
+    cv->convert.raw_text = false;
+    cv->convert.transcode = NULL;
+    cv->convert.xml = false;
+    cv->convert.seen = NULL;
+    if (opts->output_charset && !output_charset_parse(opts->output_charset, &cv->convert.raw_text)) {
+        free(cv);
+        return NULL;
+    }
+    if (opts->format) {
+        unsigned formats;
+        if (!output_format_parse(opts->format, &formats) || (formats & (formats - 1))) {
+            free(cv);
+            return NULL;
+        }
+        cv->convert.formats = formats;
+        while (!(formats & FORMAT_BIT(cv->format))) cv->format++;
+    }
+    if (opts->date_format) {
+        if (!date_layout_compile(&cv->layout, opts->date_format)) {
+            free(cv);
+            return NULL;
+        }
+        cv->convert.date_layout = &cv->layout;
+    }
+    cv->counts = ConvertCounts();
+    return cv;
+}
+
+void qxf2qif_free(qxf2qif_converter *cv) {
+    free(cv);
+}
+
+/* Convert ofx[0, len) as a complete document in cv's format into out */
+static int api_convert(qxf2qif_converter *cv, const char *ofx, size_t len, OutBuf *out) {
+    cv->counts = ConvertCounts();
+    ConvertOptions opts;
+    OutputSet outs = {};
+    outs.buf[cv->format] = out;
+    convert_options_for_input(&cv->convert, ofx, len, &opts);
+    if (!convert_parallel(ofx, ofx + len, cv->threads, &opts, &outs, NULL, &cv->counts))
+        return QXF2QIF_ERR_NOMEM;
+    return QXF2QIF_OK;
+}
+
+int qxf2qif_convert(qxf2qif_converter *cv, const char *ofx, size_t len,
+                    qxf2qif_write_fn write, void *user)
+{
+    if (!cv || (!ofx && len) || !write) return QXF2QIF_ERR_ARGS;
+    OutBuf out;
+    if (!outbuf_init_sink(&out, write, user, outbuf_estimate(len))) return QXF2QIF_ERR_NOMEM;
+    int status = api_convert(cv, ofx, len, &out);
+    if (!outbuf_flush(&out) && status == QXF2QIF_OK) status = QXF2QIF_ERR_WRITE;
+    outbuf_free(&out);
+    return status;
+}
+
+int qxf2qif_convert_buffer(qxf2qif_converter *cv, const char *ofx, size_t len,
+                           char **out, size_t *out_len)
+{
+    if (!out) return QXF2QIF_ERR_ARGS;
+    *out = NULL;
+    if (!cv || (!ofx && len) || !out_len) return QXF2QIF_ERR_ARGS;
+    OutBuf ob;
+    if (!outbuf_init(&ob, -1, outbuf_estimate(len))) return QXF2QIF_ERR_NOMEM;
+    int status = api_convert(cv, ofx, len, &ob);
+    if (status == QXF2QIF_OK) {
+        outbuf_put(&ob, "", 1);  /* NUL terminator, not counted */
+        if (ob.error) status = QXF2QIF_ERR_NOMEM;
+    }
+    if (status != QXF2QIF_OK) {
+        outbuf_free(&ob);
+        return status;
+    }
+    *out = ob.data;
+    *out_len = ob.len - 1;
+    return QXF2QIF_OK;
+}
+
+int qxf2qif_convert_file(qxf2qif_converter *cv, const char *in_path, const char *out_path) {
+    if (!cv || !in_path || !out_path) return QXF2QIF_ERR_ARGS;
+    cv->counts = ConvertCounts();
+    InputBuffer in;
+    if (!input_open(in_path, false, &in)) return QXF2QIF_ERR_READ;
+    int fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        input_close(&in);
+        return QXF2QIF_ERR_OPEN;
+    }
+    OutBuf out;
+    if (!outbuf_init(&out, fd, outbuf_estimate(in.len))) {
+        close(fd);
+        input_close(&in);
+        return QXF2QIF_ERR_NOMEM;
+    }
+    int status = api_convert(cv, in.data, in.len, &out);
+    input_close(&in);
+    if (!outbuf_flush(&out) && status == QXF2QIF_OK) status = QXF2QIF_ERR_WRITE;
+    if (close(fd) != 0 && status == QXF2QIF_OK) status = QXF2QIF_ERR_WRITE;
+    outbuf_free(&out);
+    return status;
+}
+
+long qxf2qif_transactions(const qxf2qif_converter *cv) {
+    return cv ? cv->counts.transactions : 0;
+}
+
+int qxf2qif_memos_excluded(const qxf2qif_converter *cv) {
+    return cv && cv->counts.memos_excluded;
+}
+
+const char *qxf2qif_strerror(int status) {
+    switch (status) {
+    case QXF2QIF_OK:        return "Success";
+    case QXF2QIF_ERR_ARGS:  return "Invalid argument";
+    case QXF2QIF_ERR_READ:  return "Error reading input file";
+    case QXF2QIF_ERR_OPEN:  return "Error opening output file";
+    case QXF2QIF_ERR_WRITE: return "Error writing output file";
+    case QXF2QIF_ERR_NOMEM: return "Out of memory";
+    default:                return "Unknown error";
+    }
+}
+
+int qxf2qif_next_stmttrn(const char *buf, size_t len, size_t *start, size_t *end) {
+    const char *s, *e;
+    if (!buf || !find_next_stmttrn(buf, buf + len, &s, &e)) return 0;
+    *start = (size_t)(s - buf);
+    *end = (size_t)(e - buf);
+    return 1;
+}
+
+void qxf2qif_extract_tag(const char *block, size_t len, const char *tag, char *out, size_t outsize) {
+    extract_tag_content(block, block ? block + len : NULL, tag, out, outsize);
+}
+
+int qxf2qif_ofxdate(const char *token, char *out, size_t outlen) {
+    return ofxdate_to_mmddyyyy(token, out, outlen);
+}
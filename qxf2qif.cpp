@@ -1,252 +1,767 @@
 /*
  * qxf2qif.c
  *
- * Convert a QXF (OFX/SGML) file to QIF (bank) format.
+ * Convert a QXF (OFX 1.x SGML or OFX 2.x XML) file to QIF (bank and credit
+ * card) format, and optionally to CSV, JSON Lines or a ledger journal.
  *
  * Usage: qxf2qif input.qxf output.qif
  *
- * Simple, robust, ANSI C (C99). Reads entire input file into memory.
+ * Simple, robust, ANSI C (C99). Regular files are memory-mapped and parsed
+ * in place; pipes and other non-regular inputs are read into memory.
+ * The conversion itself lives in libqxf2qif; this file is the command line.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
-#include <stdarg.h>
 #include <string.h>
-#include <ctype.h>
 #include <getopt.h>
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
 
-#define MAX_FIELD 4096
+#include "qxf2qif_cli.h"
+
+using namespace qxf2qif::detail;
 
 const char *SW_VERSION =    "1.01";
 const char *SW_DATE =       "2025-11-28";
 
-/* Read whole file into a malloc'd buffer. Returns pointer and sets length.
- * Caller must free() returned pointer. Returns NULL on error.
+/* Add ".qfx" to an input name that has no extension.
+ * As always, any '.' in the name counts as an extension.
  */
-static char *read_file_all(const char *path, long *out_len) {
-    FILE *f = fopen(path, "rb");
-    char *buf = NULL;
-    long len;
-    if (!f) return NULL;
-    if (fseek(f, 0, SEEK_END) != 0) { fclose(f); return NULL; }
-    len = ftell(f);
-    if (len < 0) { fclose(f); return NULL; }
-    if (fseek(f, 0, SEEK_SET) != 0) { fclose(f); return NULL; }
-    buf = (char *)malloc(len + 1);
-    if (!buf) { fclose(f); return NULL; }
-    if (fread(buf, 1, len, f) != (size_t)len) { free(buf); fclose(f); return NULL; }
-    buf[len] = '\0';
-    fclose(f);
-    if (out_len) *out_len = len;
-    return buf;
+static void default_input_name(char *name, size_t size) {
+    if (!strchr(name, '.') && strlen(name) + 5 <= size) strcat(name, ".qfx");
 }
 
-/* Case-insensitive search for substring in haystack.
- * Returns pointer to first match or NULL.
+/* Build the output name for inName into out. An explicit outOpt only gets
+ * ext (e.g. ".qif") added if it has no extension; otherwise the last
+ * extension of inName is replaced with ext.
+ * Returns 1 on success, 0 if inName has no extension or out is too small.
  */
-static char *strcasestr_simple(const char *hay, const char *needle) {
-    size_t nlen = strlen(needle);
-    if (nlen == 0) return (char *)hay;
-    for (; *hay; hay++) {
-        if (tolower((unsigned char)*hay) == tolower((unsigned char)*needle)) {
-            if (strncasecmp(hay, needle, nlen) == 0) return (char *)hay;
+static int derive_output_name(const char *inName, const char *outOpt, const char *ext,
+                              char *out, size_t size) {
+    const char *src = (outOpt && outOpt[0]) ? outOpt : inName;
+    size_t len = strlen(src);
+    size_t extlen = strlen(ext);
+    if (len >= size) return 0;
+    memcpy(out, src, len + 1);
+
+    if (src == outOpt) {
+        if (!strchr(out, '.')) {
+            if (len + extlen + 1 > size) return 0;
+            strcat(out, ext);
         }
+        return 1;
     }
-    return NULL;
+
+    char *cp = strrchr(out, '.');
+    if (!cp || (size_t)(cp - out) + extlen + 1 > size) return 0;
+    strcpy(cp, ext);
+    return 1;
 }
 
-/* Extract content between <TAG> and </TAG> starting from 'start' pointer.
- * tag should be uppercase tag name (e.g., "DTPOSTED"). Search is case-insensitive.
- * Writes at most out_len-1 bytes to out (null terminated).
- * Returns 1 if found and written, 0 if not found.
+/* Output names of one input, one per format written */
+struct OutputNames {
+    std::string name[FORMAT_COUNT];
+    const char *path[FORMAT_COUNT];     /* as convert_file() takes them */
+};
+
+/* Build the name of every output in formats. A single format is named as
+ * derive_output_name() does; with several, each gets its own extension,
+ * in place of outOpt's if given.
+ * Returns 1 on success, 0 as derive_output_name() does.
  */
-static int extract_tag_content_original(const char *start, const char *tag, char *out, size_t out_len) {
-    char opentag[64], closetag[64];
-    const char *p, *q;
-    size_t tlen = strlen(tag);
-
-    if (tlen + 3 >= sizeof(opentag)) return 0;
-    snprintf(opentag, sizeof(opentag), "<%s>", tag);
-    snprintf(closetag, sizeof(closetag), "</%s>", tag);
-
-    /* case-insensitive search for opentag */
-    p = strcasestr_simple(start, opentag);
-    if (!p) {
-        /* sometimes OFX uses <TAG>value (no closing tag) or inline like <TAG>value<ANOTHERTAG>
-           but in OFX/SGML usually tags are used as <TAG>value</TAG> or just <TAG>value.
-           Try a fallback: find "<TAG>" then take chars until '<' (next tag) */
-        p = strcasestr_simple(start, opentag);
-        if (!p) return 0;
-    }
-
-    p += strlen(opentag); /* move to content start */
-    q = strcasestr_simple(p, closetag);
-    if (q) {
-        size_t copylen = (size_t)(q - p);
-        if (copylen >= out_len) copylen = out_len - 1;
-        memcpy(out, p, copylen);
-        out[copylen] = '\0';
-        return 1;
-    } else {
-        /* fallback: copy until next '<' or end */
-        const char *r = p;
-        while (*r && *r != '<') r++;
-        size_t copylen = (size_t)(r - p);
-        if (copylen >= out_len) copylen = out_len - 1;
-        memcpy(out, p, copylen);
-        out[copylen] = '\0';
+static int derive_output_names(const char *inName, const char *outOpt, unsigned formats,
+                               OutputNames *names) {
+    bool several = (formats & (formats - 1)) != 0;
+    if (several && outOpt && strchr(outOpt, '.')) {
+        inName = outOpt;
+        outOpt = NULL;
+    }
+    for (int f = 0; f < FORMAT_COUNT; f++) {
+        names->path[f] = NULL;
+        if (!(formats & FORMAT_BIT(f))) continue;
+        char outName[MAX_FIELD];
+        if (!derive_output_name(inName, outOpt, output_format_extension(f), outName, sizeof(outName)))
+            return 0;
+        names->name[f] = outName;
+        names->path[f] = names->name[f].c_str();
+    }
+    return 1;
+}
+
+/* The output names, comma separated */
+static std::string join_output_names(const OutputNames &names) {
+    std::string all;
+    for (int f = 0; f < FORMAT_COUNT; f++) {
+        if (!names.path[f]) continue;
+        if (!all.empty()) all += ", ";
+        all += names.name[f];
+    }
+    return all;
+}
+
+static bool has_qfx_extension(const char *name) {
+    size_t len = strlen(name);
+    return len > 4 && fold_equal(name + len - 4, ".qfx", 4);
+}
+
+/* Append inputs named by path: a directory contributes its *.qfx files
+ * (sorted), anything else is taken as a file name.
+ * Returns 1 on success, 0 if a directory cannot be read.
+ */
+static int add_input(std::vector<std::string> *inputs, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        char name[MAX_FIELD];
+        snprintf(name, sizeof(name), "%s", path);
+        default_input_name(name, sizeof(name));
+        inputs->push_back(name);
         return 1;
     }
+
+    DIR *dir = opendir(path);
+    if (!dir) return 0;
+    std::vector<std::string> found;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (!has_qfx_extension(de->d_name)) continue;
+        std::string full = std::string(path) + "/" + de->d_name;
+        if (stat(full.c_str(), &st) == 0 && S_ISREG(st.st_mode)) found.push_back(full);
+    }
+    closedir(dir);
+    std::sort(found.begin(), found.end());
+    inputs->insert(inputs->end(), found.begin(), found.end());
+    return 1;
+}
+
+/* Append the inputs listed in a file, one per line. Blank lines and lines
+ * starting with '#' are ignored.
+ * Returns 1 on success, 0 if the list cannot be read.
+ */
+static int add_input_list(std::vector<std::string> *inputs, const char *listName) {
+    FILE *f = strcmp(listName, "-") == 0 ? stdin : fopen(listName, "r");
+    if (!f) return 0;
+    char line[MAX_FIELD];
+    int ok = 1;
+    while (ok && fgets(line, sizeof(line), f)) {
+        trim_inplace(line);
+        if (line[0] == '\0' || line[0] == '#') continue;
+        ok = add_input(inputs, line);
+    }
+    if (ferror(f)) ok = 0;
+    if (f != stdin) fclose(f);
+    return ok;
 }
 
 /*
- * Extracts the text content of an OFX/QFX tag without advancing block_start.
- *
- * Supports both long tags (<TAG>value</TAG>) and short tags (<TAG>value<OTHER>),
- * and tolerates missing closing tags (common in QFX).
+ * Work-stealing thread pool.
  *
- * Parameters:
- *   src      = pointer to the start of the STMTTRN block
- *   tag      = name of the tag without angle brackets, e.g. "NAME"
- *   out      = destination buffer
- *   outsize  = size of the destination buffer
+ * Each worker owns a deque of jobs. submit() deals jobs out round-robin;
+ * a worker runs jobs from the back of its own deque and, once that is
+ * empty, steals from the front of the others', so a few slow files do
+ * not leave the rest of the pool idle. A job is reserved (queued is
+ * decremented) before it is taken, which guarantees that the worker
+ * finds one in some deque.
  */
-void extract_tag_content(const char *src, const char *tag,
-                         char *out, size_t outsize)
+class WorkPool {
+public:
+    explicit WorkPool(int nthreads) {
+        if (nthreads < 1) nthreads = 1;
+        for (int i = 0; i < nthreads; i++) queues.emplace_back(new Queue);
+        for (int i = 0; i < nthreads; i++) threads.emplace_back(&WorkPool::run, this, i);
+    }
+
+    ~WorkPool() {
+        {
+            std::lock_guard<std::mutex> l(state_lock);
+            stopping = true;
+        }
+        work_cv.notify_all();
+        for (std::thread &t : threads) t.join();
+    }
+
+    int size() const { return (int)threads.size(); }
+
+    void submit(std::function<void()> job) {
+        Queue *q = queues[next_queue++ % queues.size()].get();
+        {
+            std::lock_guard<std::mutex> l(q->lock);
+            q->jobs.push_back(std::move(job));
+        }
+        {
+            std::lock_guard<std::mutex> l(state_lock);
+            queued++;
+        }
+        work_cv.notify_one();
+    }
+
+    /* Block until every submitted job has finished */
+    void wait_idle() {
+        std::unique_lock<std::mutex> l(state_lock);
+        idle_cv.wait(l, [this] { return queued == 0 && active == 0; });
+    }
+
+private:
+    struct Queue {
+        std::mutex                        lock;
+        std::deque<std::function<void()>> jobs;
+    };
+
+    bool take(int self, std::function<void()> *job) {
+        size_t n = queues.size();
+        for (size_t i = 0; i < n; i++) {
+            Queue *q = queues[((size_t)self + i) % n].get();
+            std::lock_guard<std::mutex> l(q->lock);
+            if (q->jobs.empty()) continue;
+            if (i == 0) {
+                *job = std::move(q->jobs.back());
+                q->jobs.pop_back();
+            } else {
+                *job = std::move(q->jobs.front());
+                q->jobs.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void run(int self) {
+        /* a worker converts file after file: reuse its output buffer */
+        outbuf_keep_spare(true);
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> l(state_lock);
+                work_cv.wait(l, [this] { return stopping || queued > 0; });
+                if (queued == 0) return;
+                queued--;
+                active++;
+            }
+            std::function<void()> job;
+            if (take(self, &job)) job();
+            {
+                std::lock_guard<std::mutex> l(state_lock);
+                active--;
+                if (queued == 0 && active == 0) idle_cv.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread>            threads;
+    std::mutex                          state_lock;
+    std::condition_variable             work_cv, idle_cv;
+    size_t                              queued = 0, active = 0;  /* under state_lock */
+    size_t                              next_queue = 0;          /* submitting thread only */
+    bool                                stopping = false;
+};
+
+/* Print the --stats report: time per phase, process CPU time, skipped
+ * blocks and peak memory. */
+static void print_stats(const ConvertCounts *counts)
 {
-    /* Initialize output */
-    if (outsize > 0)
-        out[0] = '\0';
-
-    if (!src || !tag || !out || outsize == 0)
-        return;
-
-    char open_tag[64];
-    char close_tag[64];
-
-    /* Build tag strings */
-    snprintf(open_tag, sizeof(open_tag), "<%s>", tag);
-    snprintf(close_tag, sizeof(close_tag), "</%s>", tag);
-
-    const char *p = strstr(src, open_tag);
-    if (!p)
-        return;   /* Tag not found */
-
-    p += strlen(open_tag);  /* Move past <TAG> */
-
-    /* Try to find the closing tag */
-    const char *q = strstr(p, close_tag);
-
-    if (q) {
-        /* Normal long-tag case <TAG>value</TAG> */
-        size_t len = q - p;
-        if (len >= outsize) len = outsize - 1;
-        memcpy(out, p, len);
-        out[len] = '\0';
-        return;
-    }
-
-    /*
-     * No </TAG> found → short-tag extraction.
-     *
-     * Short-tag syntax (common in QFX):
-     *     <NAME>Payment to Card<MEMO>Some memo here
-     * OR
-     *     <TRNAMT>-25.62
-     *
-     * We stop at:
-     *   - the next '<'
-     *   - end of string
-     */
-    q = strchr(p, '<');  /* Start of next tag */
-    if (!q)
-        q = p + strlen(p);  /* End of string */
-
-    size_t len = q - p;
-    if (len >= outsize) len = outsize - 1;
-
-    memcpy(out, p, len);
-    out[len] = '\0';
+    static const char *const names[PHASE_COUNT] = { "read", "scan", "extract", "format", "write" };
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+
+    printf("Phase                 :     Wall s      CPU s\n");
+    for (int k = 0; k < PHASE_COUNT; k++) {
+        printf("  %-20s: %10.6f %10.6f\n", names[k], counts->phases.wall[k], counts->phases.cpu[k]);
+    }
+    printf("Process CPU           : %.3f s user, %.3f s system\n",
+           (double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec * 1e-6,
+           (double)ru.ru_stime.tv_sec + (double)ru.ru_stime.tv_usec * 1e-6);
+    printf("Skipped Blocks        : %d\n", counts->skipped);
+    printf("Peak RSS              : %ld KiB\n", ru.ru_maxrss);
 }
 
-/* Trim leading and trailing whitespace in place */
-static void trim_inplace(char *s) {
-    char *p = s;
-    while (*p && isspace((unsigned char)*p)) p++;
-    if (p != s) memmove(s, p, strlen(p) + 1);
-    size_t len = strlen(s);
-    while (len > 0 && isspace((unsigned char)s[len - 1])) { s[len - 1] = '\0'; len--; }
+/* Write the --summary report of s to stdout in one piece, so that other
+ * threads' lines cannot land inside it */
+static void print_summary(const Summary *s, int style, int top)
+{
+    OutBuf out;
+    if (!s || !outbuf_init(&out, -1, OUTBUF_MIN)) return;
+    summary_write(s, style, top, &out);
+    fwrite(out.data, 1, out.len, stdout);
+    outbuf_free(&out);
 }
 
-/* Convert OFX date token (YYYYMMDD... ) to MM/DD/YYYY.
- * Accepts tokens beginning with YYYYMMDD (8 chars). If too short, returns 0.
- * Writes to out (outlen should be at least 11) in format "MM/DD/YYYY".
- * Returns 1 on success, 0 on failure.
+/* Convert every input on a work-stealing pool of nthreads workers and
+ * report per-file results and aggregate throughput, and with
+ * fo->summary one summary of all the files converted.
+ * Returns 0 if every file converted, otherwise the status of the first
+ * failure.
  */
-static int ofxdate_to_mmddyyyy(const char *token, char *out, size_t outlen) {
-    if (!token || strlen(token) < 8 || outlen < 11) return 0;
-    char yyyy[5], mm[3], dd[3];
-    memcpy(yyyy, token + 0, 4); yyyy[4] = '\0';
-    memcpy(mm, token + 4, 2); mm[2] = '\0';
-    memcpy(dd, token + 6, 2); dd[2] = '\0';
-    /* basic validation */
-    for (int i = 0; i < 4; i++) if (!isdigit((unsigned char)yyyy[i])) return 0;
-    for (int i = 0; i < 2; i++) if (!isdigit((unsigned char)mm[i])) return 0;
-    for (int i = 0; i < 2; i++) if (!isdigit((unsigned char)dd[i])) return 0;
-    snprintf(out, outlen, "%s/%s/%s", mm, dd, yyyy);
-    return 1;
+static int convert_batch(const std::vector<std::string> &inputs, const FileOptions *fo,
+                         int nthreads, int verbosity, int summaryStyle, int summaryTop,
+                         bool *memos_excluded)
+{
+    std::vector<OutputNames> outputs(inputs.size());
+    std::vector<FileResult> results(inputs.size());
+    double start = now_seconds();
+
+    {
+        WorkPool pool(nthreads);
+        for (size_t i = 0; i < inputs.size(); i++) {
+            if (!derive_output_names(inputs[i].c_str(), NULL, fo->convert.formats, &outputs[i])) {
+                file_fail(&results[i], -3, "Internal error with file names");
+                continue;
+            }
+            pool.submit([&, i] {
+                convert_file(inputs[i].c_str(), outputs[i].path, fo, &results[i]);
+            });
+        }
+        pool.wait_idle();
+    }
+
+    double elapsed = now_seconds() - start;
+    int status = 0, failed = 0;
+    long long transactions = 0;
+    size_t bytes = 0;
+    ConvertCounts total = ConvertCounts();
+    Summary *summary = fo->summary ? summary_new() : NULL;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        const FileResult &r = results[i];
+        if (r.status != 0) {
+            fprintf(stderr, "FAILED %s: %s\n", inputs[i].c_str(), r.error);
+            if (status == 0) status = r.status;
+            failed++;
+            summary_free(r.summary);
+            continue;
+        }
+        transactions += r.counts.transactions;
+        bytes += r.bytes_in;
+        counts_add(&total, &r.counts);
+        if (summary && r.summary) summary_merge(summary, r.summary);
+        summary_free(r.summary);
+        if (r.counts.memos_excluded) *memos_excluded = true;
+        if (verbosity >= 2) {
+            printf("OK     %s -> %s  %d transactions  %.3f s\n",
+                   inputs[i].c_str(), join_output_names(outputs[i]).c_str(),
+                   r.counts.transactions, r.seconds);
+        }
+    }
+
+    if (verbosity >= 1)
+    {
+        printf("Input Files           : %zu (%d failed)\n", inputs.size(), failed);
+        printf("Number of Transactions: %lld\n", transactions);
+        if (fo->convert.seen) printf("Already Seen          : %d\n", total.duplicates);
+        printf("Elapsed               : %.3f s on %d thread(s)\n", elapsed, nthreads);
+        if (elapsed > 0) {
+            printf("Throughput            : %.1f MB/s, %.0f transactions/s, %.1f files/s\n",
+                   (double)bytes / 1e6 / elapsed, (double)transactions / elapsed,
+                   (double)(inputs.size() - failed) / elapsed);
+        }
+    }
+    if (fo->summary && (!summary || summary_failed(summary))) {
+        fprintf(stderr, "Cannot summarise: %s\n", qxf2qif_strerror(QXF2QIF_ERR_NOMEM));
+        if (status == 0) status = QXF2QIF_ERR_NOMEM;
+    } else {
+        print_summary(summary, summaryStyle, summaryTop);
+    }
+    summary_free(summary);
+    if (fo->convert.stats) print_stats(&total);
+    return status;
 }
 
-/* Find next occurrence of "<STMTTRN" (start tag) in buffer starting at pos.
- * Then find corresponding "</STMTTRN>" end tag and return pointers.
- * Returns 1 if found and sets *startptr and *endptr (endptr points to char after end tag).
- * Returns 0 if no more found.
+/* Convert input, for watch_directory(), into temporary ".part" files that
+ * are renamed over output only once complete, so a reader never sees a
+ * partial file. If every transaction was already in the seen index, the
+ * outputs of the earlier conversion are left as they are.
  */
-static int find_next_stmttrn(const char *buf, const char *bufend, const char **startptr, const char **endptr) {
-    const char *p = buf;
-    const char *open = NULL, *close = NULL;
-    p = strcasestr_simple(p, "<STMTTRN");
-    if (!p) return 0;
-    /* Move to '>' of open tag */
-    open = strchr(p, '>');
-    if (!open) return 0;
-    open++; /* content starts here */
-    close = strcasestr_simple(open, "</STMTTRN>");
-    if (!close) return 0;
-    *startptr = open;
-    *endptr = close + strlen("</STMTTRN>");
-    return 1;
+static void watch_convert(const std::string &input, const OutputNames &output, const FileOptions *fo,
+                          int verbosity, int summaryStyle, int summaryTop)
+{
+    OutputNames part;
+    for (int f = 0; f < FORMAT_COUNT; f++) {
+        part.path[f] = NULL;
+        if (!output.path[f]) continue;
+        part.name[f] = output.name[f] + ".part";
+        part.path[f] = part.name[f].c_str();
+    }
+
+    FileResult r;
+    const char *error = convert_file(input.c_str(), part.path, fo, &r) != 0 ? r.error : NULL;
+    bool allSeen = !error && r.counts.transactions == 0 && r.counts.duplicates > 0;
+    bool replace = !error && !allSeen;
+    for (int f = 0; f < FORMAT_COUNT; f++) {
+        if (!part.path[f]) continue;
+        if (replace && rename(part.path[f], output.path[f]) != 0) {
+            error = "Cannot rename the output into place";
+            replace = false;
+        }
+        if (!replace) unlink(part.path[f]);
+    }
+
+    if (error) {
+        fprintf(stderr, "FAILED %s: %s\n", input.c_str(), error);
+    } else if (allSeen) {
+        if (verbosity >= 1) {
+            printf("SEEN   %s  all %d transactions already converted\n",
+                   input.c_str(), r.counts.duplicates);
+            fflush(stdout);
+        }
+    } else {
+        if (verbosity >= 1) {
+            printf("OK     %s -> %s  %d transactions  %.3f s\n",
+                   input.c_str(), join_output_names(output).c_str(),
+                   r.counts.transactions, r.seconds);
+        }
+        print_summary(r.summary, summaryStyle, summaryTop);
+        fflush(stdout);
+    }
+    summary_free(r.summary);
 }
 
+/* State of a watched file with a conversion queued or running */
+enum {
+    WATCH_QUEUED,
+    WATCH_RUNNING,
+    WATCH_CHANGED       /* running, and written again since it started */
+};
+
+/* Convert every .qfx file written or moved into dir, until SIGINT or
+ * SIGTERM. Conversions run on a resident pool of nthreads workers as
+ * soon as inotify reports the file closed, and each gets the output name
+ * a batch run would give it, and with fo->summary a summary of its own.
+ * A file has at most one conversion queued or running: events for it
+ * while it is queued are dropped, and one while it converts makes it
+ * convert once more afterwards. Files already in dir are left alone.
+ * Returns 0 after a signal, -4 if dir cannot be watched.
+ */
+static int watch_directory(const char *dir, const FileOptions *fo, int nthreads, int verbosity,
+                           int summaryStyle, int summaryTop)
+{
+    int ifd = inotify_init1(IN_CLOEXEC);
+    if (ifd < 0 || inotify_add_watch(ifd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        if (ifd >= 0) close(ifd);
+        return -4;
+    }
+
+    /* the signals stay blocked, in the workers too, and are taken from a
+       signalfd polled with the inotify fd, so one arriving at any moment
+       ends the wait */
+    sigset_t stopSignals, oldMask;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, &oldMask);
+    int sfd = signalfd(-1, &stopSignals, SFD_CLOEXEC);
+    if (sfd < 0) {
+        pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+        close(ifd);
+        return -4;
+    }
+    std::mutex pendingLock;
+    std::map<std::string, int> pending;     /* input -> WATCH_*, under pendingLock */
+    WorkPool pool(nthreads);
+
+    if (verbosity >= 1) {
+        printf("Watching %s on %d thread(s)\n", dir, pool.size());
+        fflush(stdout);
+    }
+
+    alignas(struct inotify_event) char events[64 * 1024];
+    for (;;) {
+        struct pollfd fds[2] = {{ifd, POLLIN, 0}, {sfd, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents) {
+            struct signalfd_siginfo si;
+            if (read(sfd, &si, sizeof(si)) == (ssize_t)sizeof(si)) break;
+            continue;
+        }
+        ssize_t n = read(ifd, events, sizeof(events));
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            break;
+        }
+        for (char *p = events; p < events + n; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof(*ev) + ev->len;
+            if (!ev->len || (ev->mask & IN_ISDIR) || !has_qfx_extension(ev->name)) continue;
+
+            std::string input = std::string(dir) + "/" + ev->name;
+            auto output = std::make_shared<OutputNames>();
+            if (!derive_output_names(input.c_str(), NULL, fo->convert.formats, output.get())) continue;
+            {
+                std::lock_guard<std::mutex> l(pendingLock);
+                auto it = pending.find(input);
+                if (it != pending.end()) {
+                    if (it->second == WATCH_RUNNING) it->second = WATCH_CHANGED;
+                    continue;
+                }
+                pending[input] = WATCH_QUEUED;
+            }
+            pool.submit([&pending, &pendingLock, fo, verbosity, summaryStyle, summaryTop, input, output] {
+                {
+                    std::lock_guard<std::mutex> l(pendingLock);
+                    pending[input] = WATCH_RUNNING;
+                }
+                for (;;) {
+                    watch_convert(input, *output, fo, verbosity, summaryStyle, summaryTop);
+                    std::lock_guard<std::mutex> l(pendingLock);
+                    auto it = pending.find(input);
+                    if (it->second != WATCH_CHANGED) {
+                        pending.erase(it);
+                        break;
+                    }
+                    it->second = WATCH_RUNNING;
+                }
+            });
+        }
+    }
+    pool.wait_idle();
+    close(sfd);
+    close(ifd);
+    pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+    return 0;
+}
+
+/* getopt codes for long-only options */
+enum {
+    OPT_POPULATE = 256,
+    OPT_STREAM,
+    OPT_INPUT_LIST,
+    OPT_STATS,
+    OPT_DATE_FORMAT,
+    OPT_OUTPUT_CHARSET,
+    OPT_SEEN_INDEX,
+    OPT_WATCH,
+    OPT_FORMAT,
+    OPT_MERGE,
+    OPT_DEDUP,
+    OPT_MEMORY_LIMIT,
+    OPT_SUMMARY,
+    OPT_TOP
+};
+
 void usage(const char *prog, const char *extraLine = (const char *)(NULL));
 
 void usage(const char *prog, const char *extraLine)
 {
     fprintf(stderr, "%s Ver %s %s\n", prog, SW_VERSION, SW_DATE);
-    fprintf(stderr, "usage: %s <options>\n", prog);
-    fprintf(stderr, "-i --input filename       input .qfx file.\n");
+    fprintf(stderr, "usage: %s <options> [input ...]\n", prog);
+    fprintf(stderr, "-i --input filename       input .qfx file, or a directory of .qfx files.\n");
     fprintf(stderr, "                          Extension will be added if not provided.\n");
     fprintf(stderr, "-o --output filename      output .qif file.\n");
     fprintf(stderr, "                          Filename will be generated from input filename\n");
     fprintf(stderr, "                          if not provided.\n");
+    fprintf(stderr, "   --format LIST          Output formats, comma separated: qif (default),\n");
+    fprintf(stderr, "                          csv, jsonl, ledger. Each is written to its own\n");
+    fprintf(stderr, "                          file (.qif .csv .jsonl .journal) from one read.\n");
     fprintf(stderr, "-m --memo                 Include memos.\n");
     fprintf(stderr, "-q --quiet                Quiet running (or decrease verbosity).\n");
+    fprintf(stderr, "-t --threads N            Convert using N threads (0 = one per CPU).\n");
     fprintf(stderr, "-v --verbose              Increase verbosity\n");
+    fprintf(stderr, "   --date-format LAYOUT   Date layout using %%Y %%y %%m %%d %%H %%M %%S\n");
+    fprintf(stderr, "                          (default %%m/%%d/%%Y).\n");
+    fprintf(stderr, "   --input-list FILE      Also convert the inputs listed in FILE, one per\n");
+    fprintf(stderr, "                          line ('-' for stdin).\n");
+    fprintf(stderr, "   --output-charset CS    Payee and memo text: utf-8 (default, converted\n");
+    fprintf(stderr, "                          from the input's declared charset) or raw.\n");
+    fprintf(stderr, "   --merge                Write all inputs as one output sorted by date\n");
+    fprintf(stderr, "                          (-o names it; default merged.qif).\n");
+    fprintf(stderr, "   --dedup                With --merge, drop transactions whose account\n");
+    fprintf(stderr, "                          and FITID were already written.\n");
+    fprintf(stderr, "   --memory-limit MB      With --merge, memory for transactions, read or\n");
+    fprintf(stderr, "                          being read, before sorted runs spill to\n");
+    fprintf(stderr, "                          temporary files (default %d; each file being\n",
+            MERGE_MEMORY_DEFAULT);
+    fprintf(stderr, "                          read may take 8 more).\n");
+    fprintf(stderr, "   --populate             Prefault the whole input mapping up front.\n");
+    fprintf(stderr, "   --seen-index FILE      Skip transactions whose account and FITID are\n");
+    fprintf(stderr, "                          in FILE, and add those converted to it\n");
+    fprintf(stderr, "                          (created if missing; inputs convert one at\n");
+    fprintf(stderr, "                          a time).\n");
+    fprintf(stderr, "   --stats                Report time per phase, throughput, skipped\n");
+    fprintf(stderr, "                          transactions and peak memory.\n");
+    fprintf(stderr, "   --summary[=STYLE]      Also report credits and debits per month, the\n");
+    fprintf(stderr, "                          top payees by spend and the date range, as a\n");
+    fprintf(stderr, "                          table (default) or json.\n");
+    fprintf(stderr, "   --top N                Payees listed by --summary (default %d).\n",
+            SUMMARY_TOP_DEFAULT);
+    fprintf(stderr, "   --stream               Read input in fixed-size chunks instead of\n");
+    fprintf(stderr, "                          loading it whole (bounded memory).\n");
+    fprintf(stderr, "   --watch DIR            Stay running and convert each .qfx file\n");
+    fprintf(stderr, "                          written or moved into DIR, until interrupted.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Several inputs (extra arguments, --input-list or a directory) are\n");
+    fprintf(stderr, "converted concurrently, each to its own output files; -t then sets the\n");
+    fprintf(stderr, "number of files converted at once.\n");
     if (extraLine) fprintf(stderr, "\n%s\n", extraLine);
 }
 
+/* Collect the inputs named by -i, the remaining arguments and --input-list.
+ * Returns 0, or the exit status after reporting why not.
+ */
+static int gather_inputs(std::vector<std::string> *inputs, const char *prog, const char *inFileName,
+                         char *const *args, int nargs, const char *inputListName)
+{
+    if ('\0' != inFileName[0] && !add_input(inputs, inFileName))
+    {
+        usage(prog, "Error reading input directory");
+        return -4;
+    }
+    for (int a = 0; a < nargs; a++)
+    {
+        if (!add_input(inputs, args[a]))
+        {
+            usage(prog, "Error reading input directory");
+            return -4;
+        }
+    }
+    if (inputListName && !add_input_list(inputs, inputListName))
+    {
+        usage(prog, "Error reading input list");
+        return -4;
+    }
+    if (inputs->empty())
+    {
+        usage(prog, "No input files found");
+        return -2;
+    }
+    return 0;
+}
+
+/* Convert every input on nthreads threads into one output sorted by
+ * posted date, named after outOpt (or "merged").
+ * Returns 0 on success, otherwise the status of the first failure.
+ */
+static int merge_inputs(const std::vector<std::string> &inputs, const char *prog, const char *outOpt,
+                        const FileOptions *fo, int nthreads, size_t memoryLimit, bool dedup,
+                        int verbosity, int summaryStyle, int summaryTop)
+{
+    OutputNames outNames;
+    if (!derive_output_names("merged.qfx", outOpt, fo->convert.formats, &outNames))
+    {
+        usage(prog, "Internal error with file names");
+        return -3;
+    }
+    Merger *merger = merger_new(memoryLimit, dedup);
+    if (!merger)
+    {
+        usage(prog, qxf2qif_strerror(QXF2QIF_ERR_NOMEM));
+        return QXF2QIF_ERR_NOMEM;
+    }
+
+    double start = now_seconds();
+    std::vector<FileResult> results(inputs.size());
+    {
+        WorkPool pool(nthreads);
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            pool.submit([&, i] {
+                merger_add(merger, i, inputs[i].c_str(), fo, &results[i]);
+            });
+        }
+        pool.wait_idle();
+    }
+
+    int status = 0;
+    size_t bytes = 0;
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        const FileResult &r = results[i];
+        if (r.status != 0)
+        {
+            fprintf(stderr, "FAILED %s: %s\n", inputs[i].c_str(), r.error);
+            if (status == 0) status = r.status;
+        }
+        bytes += r.bytes_in;
+    }
+    FileResult res = FileResult();
+    if (status == 0 && merger_write(merger, outNames.path, fo, &res) != 0)
+    {
+        usage(prog, res.error);
+        status = res.status;
+    }
+    int spilled = merger_spilled(merger);
+    merger_free(merger);
+    if (status != 0)
+    {
+        summary_free(res.summary);
+        return status;
+    }
+
+    double elapsed = now_seconds() - start;
+    if (verbosity >= 1)
+    {
+        printf("Input Files           : %zu\n", inputs.size());
+        for (int f = 0; f < FORMAT_COUNT; f++)
+        {
+            if (outNames.path[f]) printf("Output File           : %s\n", outNames.path[f]);
+        }
+        printf("Number of Transactions: %d\n", res.counts.transactions);
+        if (dedup) printf("Duplicates Dropped    : %d\n", res.counts.duplicates);
+        if (spilled) printf("Spill Files           : %d\n", spilled);
+    }
+    print_summary(res.summary, summaryStyle, summaryTop);
+    summary_free(res.summary);
+    if (fo->convert.stats)
+    {
+        double secs = elapsed > 0 ? elapsed : 1e-9;
+        printf("Elapsed               : %.3f s on %d thread(s)\n", elapsed, nthreads);
+        printf("Throughput            : %.1f MB/s, %.0f transactions/s\n",
+               (double)bytes / 1e6 / secs, (double)res.counts.transactions / secs);
+    }
+    if (res.counts.memos_excluded)
+    {
+        fprintf(stderr, "Memos appear in input files but are excluded from output.\n");
+        fprintf(stderr, "Use -m to include memos in output.\n");
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     int                 opt;
     char                inFileName[MAX_FIELD];
     char                outFileName[MAX_FIELD];
+    const char          *inputListName = NULL;
     bool                usageError = false;
-    char                *cp;
     int                 verbosity = 1;
-    int                 numTransactions = 0;
     bool                memoFlag = false;
-    bool                printMemoWarning = false;
+    bool                populateFlag = false;
+    bool                streamFlag = false;
+    bool                statsFlag = false;
+    DateLayout          dateLayout;
+    bool                dateLayoutSet = false;
+    bool                rawText = false;
+    const char          *seenIndexName = NULL;
+    SeenIndex           *seenIndex = NULL;
+    const char          *watchDir = NULL;
+    unsigned            formats = FORMAT_BIT(FORMAT_QIF);
+    bool                mergeFlag = false;
+    bool                dedupFlag = false;
+    long                memoryLimit = MERGE_MEMORY_DEFAULT;
+    bool                summaryFlag = false;
+    int                 summaryStyle = SUMMARY_TABLE;
+    int                 summaryTop = SUMMARY_TOP_DEFAULT;
+    int                 numThreads = 1;
+    bool                threadsSet = false;
+    FileOptions         fo;
+    FileResult          res;
 
     inFileName[0] = '\0';
     outFileName[0] = '\0';
@@ -258,13 +773,28 @@ int main(int argc, char *argv[])
             ,{"memo",       no_argument,        0,      'm'}
             ,{"quiet",      no_argument,        0,      'q'}
             ,{"verbose",    no_argument,        0,      'v'}
+            ,{"populate",   no_argument,        0,      OPT_POPULATE}
+            ,{"stream",     no_argument,        0,      OPT_STREAM}
+            ,{"threads",    required_argument,  0,      't'}
+            ,{"input-list", required_argument,  0,      OPT_INPUT_LIST}
+            ,{"stats",      no_argument,        0,      OPT_STATS}
+            ,{"date-format", required_argument, 0,      OPT_DATE_FORMAT}
+            ,{"output-charset", required_argument, 0,   OPT_OUTPUT_CHARSET}
+            ,{"seen-index", required_argument,  0,      OPT_SEEN_INDEX}
+            ,{"watch",      required_argument,  0,      OPT_WATCH}
+            ,{"format",     required_argument,  0,      OPT_FORMAT}
+            ,{"merge",      no_argument,        0,      OPT_MERGE}
+            ,{"dedup",      no_argument,        0,      OPT_DEDUP}
+            ,{"memory-limit", required_argument, 0,     OPT_MEMORY_LIMIT}
+            ,{"summary",    optional_argument,  0,      OPT_SUMMARY}
+            ,{"top",        required_argument,  0,      OPT_TOP}
             ,{0,0,0,0}
         };
 
     while (1)
     {
         int optionIndex = 0;
-        opt = getopt_long(argc, argv, "i:o:mqv", longOptions, &optionIndex);
+        opt = getopt_long(argc, argv, "i:o:mqt:v", longOptions, &optionIndex);
 
         if (-1 == opt) break;
 
@@ -285,6 +815,82 @@ int main(int argc, char *argv[])
         case 'v':
             ++verbosity;
             break;
+        case OPT_POPULATE:
+            populateFlag = true;
+            break;
+        case OPT_STREAM:
+            streamFlag = true;
+            break;
+        case 't':
+            numThreads = atoi(optarg);
+            if (numThreads <= 0) numThreads = (int)std::thread::hardware_concurrency();
+            if (numThreads <= 0) numThreads = 1;
+            threadsSet = true;
+            break;
+        case OPT_INPUT_LIST:
+            inputListName = optarg;
+            break;
+        case OPT_STATS:
+            statsFlag = true;
+            break;
+        case OPT_DATE_FORMAT:
+            if (!date_layout_compile(&dateLayout, optarg))
+            {
+                usage(basename(argv[0]), "Invalid --date-format layout");
+                return -1;
+            }
+            dateLayoutSet = true;
+            break;
+        case OPT_OUTPUT_CHARSET:
+            if (!output_charset_parse(optarg, &rawText))
+            {
+                usage(basename(argv[0]), "Unknown --output-charset");
+                return -1;
+            }
+            break;
+        case OPT_SEEN_INDEX:
+            seenIndexName = optarg;
+            break;
+        case OPT_WATCH:
+            watchDir = optarg;
+            break;
+        case OPT_MERGE:
+            mergeFlag = true;
+            break;
+        case OPT_DEDUP:
+            dedupFlag = true;
+            break;
+        case OPT_MEMORY_LIMIT:
+            memoryLimit = atol(optarg);
+            if (memoryLimit <= 0)
+            {
+                usage(basename(argv[0]), "Invalid --memory-limit");
+                return -1;
+            }
+            break;
+        case OPT_SUMMARY:
+            if (optarg && !summary_style_parse(optarg, &summaryStyle))
+            {
+                usage(basename(argv[0]), "Unknown --summary style");
+                return -1;
+            }
+            summaryFlag = true;
+            break;
+        case OPT_TOP:
+            summaryTop = atoi(optarg);
+            if (summaryTop < 0)
+            {
+                usage(basename(argv[0]), "Invalid --top");
+                return -1;
+            }
+            break;
+        case OPT_FORMAT:
+            if (!output_format_parse(optarg, &formats))
+            {
+                usage(basename(argv[0]), "Unknown --format");
+                return -1;
+            }
+            break;
         default:
             usageError = true;
             break;
@@ -297,187 +903,190 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    struct stat st;
+    bool batch = optind < argc || inputListName
+                 || ('\0' != inFileName[0] && stat(inFileName, &st) == 0 && S_ISDIR(st.st_mode));
+
+    if (mergeFlag && (watchDir || seenIndexName))
+    {
+        usage(basename(argv[0]), "--merge cannot be combined with --watch or --seen-index");
+        return -1;
+    }
+
+    if (watchDir && (batch || '\0' != inFileName[0] || '\0' != outFileName[0]))
+    {
+        usage(basename(argv[0]), "--watch cannot be combined with other inputs or -o");
+        return -1;
+    }
+
     // strcpy(inFileName, "/home/bruno/Downloads/transactions.qfx");
-    if ('\0' == inFileName[0])
+    if ('\0' == inFileName[0] && !batch && !watchDir && !mergeFlag)
     {
         usage(basename(argv[0]), "Input filename required");
         return -2;
     }
 
-    cp = strchr(inFileName, '.');
-    if ((char *)(NULL) == cp)
-    {
-        // No extension provided.  Add .qfx
-        strncat(inFileName, ".qfx", 5);
-    }
+    fo.convert.formats = formats;
+    fo.convert.memo = memoFlag;
+    fo.convert.stats = statsFlag;
+    fo.convert.date_layout = dateLayoutSet ? &dateLayout : NULL;
+    fo.convert.raw_text = rawText;
+    fo.convert.transcode = NULL;
+    fo.convert.xml = false;
+    fo.convert.seen = NULL;
+    fo.populate = populateFlag;
+    fo.stream = streamFlag;
+    fo.threads = 1;
+    fo.listing = false;
+    fo.summary = summaryFlag;
 
-    if ('\0' == outFileName[0])
+    if (watchDir)
     {
-        // Create output file name from input file name
-        strncpy(outFileName, inFileName, sizeof(outFileName)-1);
-        cp = strrchr(outFileName, '.');
-        if ((char *)(NULL) == cp)
+        if (!threadsSet)
         {
-            // Something went wrong because there should
-            // definately be a '.' in the filename
-            usage(basename(argv[0]), "Internal error with file names");
-            return -3;
+            numThreads = (int)std::thread::hardware_concurrency();
+            if (numThreads <= 0) numThreads = 1;
         }
-        else
+        if (seenIndexName)
         {
-            *cp = '\0';
-            strncat(outFileName, ".qif", 5);
+            numThreads = 1;
+            seenIndex = seen_open(seenIndexName);
+            if (!seenIndex)
+            {
+                usage(basename(argv[0]), "Cannot open the seen index");
+                return -4;
+            }
+            fo.convert.seen = seenIndex;
         }
+        int status = watch_directory(watchDir, &fo, numThreads, verbosity, summaryStyle, summaryTop);
+        seen_close(seenIndex);
+        if (status != 0) usage(basename(argv[0]), "Cannot watch the directory");
+        return status;
     }
-    else
+
+    if (mergeFlag)
     {
-        // An output file name was provided.
-        // See if it has an extension
-        cp = strchr(outFileName, '.');
-        if ((char *)(NULL) == cp)
+        std::vector<std::string> inputs;
+        int status = gather_inputs(&inputs, basename(argv[0]), inFileName,
+                                   argv + optind, argc - optind, inputListName);
+        if (status != 0) return status;
+        if (!threadsSet)
         {
-            // No extension provided.  Add .qif
-            strncat(outFileName, ".qif", 5);
+            numThreads = (int)std::thread::hardware_concurrency();
+            if (numThreads <= 0) numThreads = 1;
         }
-    }
-    long len;
-    char *buf = read_file_all(inFileName, &len);
-    if (!buf) {
-        usage(basename(argv[0]), "Error reading input file");
-        return -4;
+        if ((size_t)numThreads > inputs.size()) numThreads = (int)inputs.size();
+        return merge_inputs(inputs, basename(argv[0]), outFileName, &fo, numThreads,
+                            (size_t)memoryLimit << 20, dedupFlag, verbosity, summaryStyle, summaryTop);
     }
 
-    FILE *fout = fopen(outFileName, "w");
-    if (!fout) {
-        usage(basename(argv[0]), "Error opening output file");
-        free(buf);
-        return -5;
-    }
-
-    fprintf(fout, "!Type:Bank\n");
-
-    const char *scan = buf;
-    const char *bufend = buf + len;
-
-    while (1) {
-        const char *block_start, *block_after;
-        if (!find_next_stmttrn(scan, bufend, &block_start, &block_after)) break;
-
-        char dtposted[MAX_FIELD] = {0};
-        char trnamt[MAX_FIELD] = {0};
-        char name[MAX_FIELD] = {0};
-        char memo[MAX_FIELD] = {0};
-
-        /* Extract tags from block_start (which points at content after opening <STMTTRN>) */
-        extract_tag_content(block_start, "DTPOSTED", dtposted, sizeof(dtposted));
-        extract_tag_content(block_start, "TRNAMT", trnamt, sizeof(trnamt));
-        extract_tag_content(block_start, "NAME", name, sizeof(name));
-        extract_tag_content(block_start, "MEMO", memo, sizeof(memo));
-
-        trim_inplace(dtposted);
-        trim_inplace(trnamt);
-        trim_inplace(name);
-        trim_inplace(memo);
-
-        /* sanitize name and memo: remove newlines */
-        for (char *p = name; *p; ++p) if (*p == '\r' || *p == '\n') *p = ' ';
-        for (char *p = memo; *p; ++p) if (*p == '\r' || *p == '\n') *p = ' ';
-
-        /* convert date */
-        char qifdate[16] = {0};
-        if (!ofxdate_to_mmddyyyy(dtposted, qifdate, sizeof(qifdate))) {
-            /* try alternate: maybe date is like YYYYMMDD (8 chars) or YYYYMMDDHHMMSS. If still fails, skip */
-            /* Skip this transaction if no valid date; but still attempt to use DTPOSTED raw first 8 */
-            if (strlen(dtposted) >= 8) {
-                char tmp[16];
-                strncpy(tmp, dtposted, 8); tmp[8] = '\0';
-                if (!ofxdate_to_mmddyyyy(tmp, qifdate, sizeof(qifdate))) {
-                    /* failed */
-                    qifdate[0] = '\0';
-                }
-            }
-        }
+    if (batch)
+    {
+        std::vector<std::string> inputs;
+        bool memosExcluded = false;
 
-        /* require at least an amount; skip if none */
-        if (trnamt[0] == '\0') {
-            scan = block_after;
-            continue;
+        if ('\0' != outFileName[0])
+        {
+            usage(basename(argv[0]), "-o cannot be used with multiple inputs");
+            return -1;
         }
+        int status = gather_inputs(&inputs, basename(argv[0]), inFileName,
+                                   argv + optind, argc - optind, inputListName);
+        if (status != 0) return status;
 
-        /* ensure amount uses point (OFX does) and no commas; strip commas (just in case) */
-        char amt_clean[MAX_FIELD];
-        size_t ai = 0;
-        for (size_t i = 0; trnamt[i] && ai + 1 < sizeof(amt_clean); ++i) {
-            if (trnamt[i] == ',') continue;
-            amt_clean[ai++] = trnamt[i];
+        if (!threadsSet)
+        {
+            numThreads = (int)std::thread::hardware_concurrency();
+            if (numThreads <= 0) numThreads = 1;
         }
-        amt_clean[ai] = '\0';
-
-        /* If date conversion failed, use a fallback: print original DTPOSTED */
-        if (qifdate[0] == '\0') {
-            /* try to use YYYYMMDD -> MM/DD/YYYY as best-effort using first 8 chars */
-            if (strlen(dtposted) >= 8) {
-                char tmp[9]; memcpy(tmp, dtposted, 8); tmp[8] = '\0';
-                if (!ofxdate_to_mmddyyyy(tmp, qifdate, sizeof(qifdate))) {
-                    /* give up and skip date field (not ideal) */
-                    strncpy(qifdate, dtposted, sizeof(qifdate)-1);
-                }
-            } else {
-                strncpy(qifdate, dtposted, sizeof(qifdate)-1);
+        if ((size_t)numThreads > inputs.size()) numThreads = (int)inputs.size();
+
+        if (seenIndexName)
+        {
+            /* files are checked against the index in input order */
+            numThreads = 1;
+            seenIndex = seen_open(seenIndexName);
+            if (!seenIndex)
+            {
+                usage(basename(argv[0]), "Cannot open the seen index");
+                return -4;
             }
+            fo.convert.seen = seenIndex;
         }
 
-        /* QIF: Date (D), Payee/Description (P), Amount (T), Cleared (C*), end(^) */
-        if (qifdate[0] != '\0') {
-            fprintf(fout, "D%s\n", qifdate);
-        } else {
-            fprintf(fout, "D\n"); /* empty date (shouldn't happen) */
+        status = convert_batch(inputs, &fo, numThreads, verbosity, summaryStyle, summaryTop,
+                               &memosExcluded);
+        seen_close(seenIndex);
+        if (memosExcluded)
+        {
+            fprintf(stderr, "Memos appear in input files but are excluded from output.\n");
+            fprintf(stderr, "Use -m to include memos in output.\n");
         }
+        return status;
+    }
 
-        /* If name is empty, use a placeholder */
-        if (name[0] == '\0') {
-            fprintf(fout, "P(unknown)\n");
-        } else {
-            /* sanitize name: remove internal newlines */
-            for (char *p = name; *p; ++p) if (*p == '\r' || *p == '\n') *p = ' ';
-            fprintf(fout, "P%s\n", name);
-        }
+    if (streamFlag && numThreads > 1)
+    {
+        usage(basename(argv[0]), "--threads cannot be combined with --stream");
+        return -1;
+    }
 
-        if (memo[0]) {
-            if (memoFlag) {
-                fprintf(fout, "M%s\n", memo);  // <-- MEMO line added
-            } else {
-                printMemoWarning = true;
-            }
-        }
-        fprintf(fout, "T%s\n", amt_clean);
-        fprintf(fout, "C*\n");
-        fprintf(fout, "^\n");
+    // No extension provided.  Add .qfx
+    default_input_name(inFileName, sizeof(inFileName));
 
-        ++numTransactions;
+    OutputNames outNames;
+    if (!derive_output_names(inFileName, outFileName, formats, &outNames))
+    {
+        // Something went wrong because there should
+        // definately be a '.' in the filename
+        usage(basename(argv[0]), "Internal error with file names");
+        return -3;
+    }
 
-        if  (verbosity >= 2)
+    fo.threads = numThreads;
+    fo.listing = verbosity >= 2;
+    if (seenIndexName)
+    {
+        seenIndex = seen_open(seenIndexName);
+        if (!seenIndex)
         {
-            if (memo[0] && !memoFlag) {
-                strncpy(memo, "EXCLUDED", 9);
-            }
-            printf("%s\t%.16s\t%.8s\t$%s\n", qifdate, name, memo, amt_clean);
+            usage(basename(argv[0]), "Cannot open the seen index");
+            return -4;
         }
-
-        scan = block_after;
+        fo.convert.seen = seenIndex;
+    }
+    int converted = convert_file(inFileName, outNames.path, &fo, &res);
+    seen_close(seenIndex);
+    if (converted != 0)
+    {
+        summary_free(res.summary);
+        usage(basename(argv[0]), res.error);
+        return res.status;
     }
-
-    fclose(fout);
-    free(buf);
 
     if (verbosity >= 1)
     {
         printf("Input File            : %s\n", inFileName);
-        printf("Output File           : %s\n", outFileName);
-        printf("Number of Transactions: %d\n", numTransactions);
+        for (int f = 0; f < FORMAT_COUNT; f++)
+        {
+            if (outNames.path[f]) printf("Output File           : %s\n", outNames.path[f]);
+        }
+        printf("Number of Transactions: %d\n", res.counts.transactions);
+        if (seenIndexName) printf("Already Seen          : %d\n", res.counts.duplicates);
+    }
+    print_summary(res.summary, summaryStyle, summaryTop);
+    summary_free(res.summary);
+
+    if (statsFlag)
+    {
+        double secs = res.seconds > 0 ? res.seconds : 1e-9;
+        printf("Elapsed               : %.3f s\n", res.seconds);
+        printf("Throughput            : %.1f MB/s, %.0f transactions/s\n",
+               (double)res.bytes_in / 1e6 / secs, (double)res.counts.transactions / secs);
+        print_stats(&res.counts);
     }
 
-    if (printMemoWarning)
+    if (res.counts.memos_excluded)
     {
         fprintf(stderr, "Memos appear in input file but are excluded from output.\n");
         fprintf(stderr, "Use -m to include memos in output.\n");
@@ -0,0 +1,161 @@
+/*
+ * qxf2qif.h
+ *
+ * Library interface of the QXF (OFX SGML or XML) to QIF converter.
+ *
+ * A converter handle holds its options and the totals of its last
+ * conversion, nothing more. Handles are independent: threads may convert
+ * at the same time as long as each uses its own handle.
+ */
+
+#ifndef QXF2QIF_H
+#define QXF2QIF_H
+
+#include <stddef.h>
+
+/* Marks the functions the library exports; everything else in it is
+ * built with hidden visibility */
+#if defined(__GNUC__)
+#define QXF2QIF_API __attribute__((visibility("default")))
+#else
+#define QXF2QIF_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Status codes. The errors match the exit codes of the qxf2qif program. */
+#define QXF2QIF_OK          0
+#define QXF2QIF_ERR_ARGS    (-1)    /* invalid argument */
+#define QXF2QIF_ERR_READ    (-4)    /* input file cannot be read */
+#define QXF2QIF_ERR_OPEN    (-5)    /* output file cannot be created */
+#define QXF2QIF_ERR_WRITE   (-6)    /* writing output failed */
+#define QXF2QIF_ERR_NOMEM   (-7)    /* out of memory */
+
+typedef struct qxf2qif_options {
+    int memo;       /* non-zero: write M (memo) lines */
+    int threads;    /* threads for one input; 1 converts on the calling thread */
+    const char *date_format;    /* strftime-style date layout using %Y %y %m %d
+                                   %H %M %S %%; NULL for %m/%d/%Y */
+    const char *output_charset; /* NAME and MEMO text: "utf-8" (NULL) converts
+                                   from the charset the OFX header declares,
+                                   "raw" copies the bytes as sent */
+    const char *format;         /* output format: "qif" (NULL), "csv", "jsonl"
+                                   or "ledger" */
+} qxf2qif_options;
+
+typedef struct qxf2qif_converter qxf2qif_converter;
+
+/* Receives the output in order, in pieces of any size.
+ * Return 0 to continue; anything else stops further output and the
+ * conversion fails with QXF2QIF_ERR_WRITE.
+ */
+typedef int (*qxf2qif_write_fn)(void *user, const char *data, size_t len);
+
+/* Fill opts with the defaults: QIF output, no memos, one thread,
+ * MM/DD/YYYY dates, UTF-8 text */
+QXF2QIF_API void qxf2qif_options_init(qxf2qif_options *opts);
+
+/* Create a converter. opts may be NULL for the defaults; it is not
+ * referenced after the call. Returns NULL if out of memory or
+ * opts->date_format, opts->output_charset or opts->format is invalid.
+ * Release with qxf2qif_free().
+ */
+QXF2QIF_API qxf2qif_converter *qxf2qif_new(const qxf2qif_options *opts);
+QXF2QIF_API void qxf2qif_free(qxf2qif_converter *cv);
+
+/* Convert the OFX text ofx[0, len) to a document passed to write.
+ * ofx need not be NUL terminated. Returns a QXF2QIF_* status.
+ */
+QXF2QIF_API int qxf2qif_convert(qxf2qif_converter *cv, const char *ofx, size_t len,
+                                qxf2qif_write_fn write, void *user);
+
+/* Convert ofx[0, len) into a malloc'd, NUL terminated buffer returned in
+ * *out (length in *out_len, without the NUL). The caller frees *out.
+ * Returns a QXF2QIF_* status; *out is NULL on error.
+ */
+QXF2QIF_API int qxf2qif_convert_buffer(qxf2qif_converter *cv, const char *ofx, size_t len,
+                                       char **out, size_t *out_len);
+
+/* Convert the file in_path to the file out_path. Returns a QXF2QIF_* status. */
+QXF2QIF_API int qxf2qif_convert_file(qxf2qif_converter *cv, const char *in_path, const char *out_path);
+
+/* Totals of the last conversion with cv */
+QXF2QIF_API long qxf2qif_transactions(const qxf2qif_converter *cv);
+QXF2QIF_API int qxf2qif_memos_excluded(const qxf2qif_converter *cv);
+
+/* Message for a QXF2QIF_* status */
+QXF2QIF_API const char *qxf2qif_strerror(int status);
+
+/*
+ * Parsing helpers for callers that walk a statement themselves.
+ */
+
+/* Find the next <STMTTRN> ... </STMTTRN> block in buf[0, len).
+ * On success *start is the offset of its content and *end the offset just
+ * past the end tag. Returns 1 if found, 0 if there are no more.
+ */
+QXF2QIF_API int qxf2qif_next_stmttrn(const char *buf, size_t len, size_t *start, size_t *end);
+
+/* Copy the text of <tag> (long or short form) in block[0, len) into out,
+ * truncated to outsize - 1 bytes and NUL terminated. out is empty if the
+ * tag is missing.
+ */
+QXF2QIF_API void qxf2qif_extract_tag(const char *block, size_t len, const char *tag, char *out, size_t outsize);
+
+/* Convert an OFX date (YYYYMMDD...) to MM/DD/YYYY; outlen must be at least 11.
+ * Returns 1 on success, 0 if token does not start with a date.
+ */
+QXF2QIF_API int qxf2qif_ofxdate(const char *token, char *out, size_t outlen);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+
+namespace qxf2qif {
+
+/* Owning C++ wrapper around a qxf2qif_converter */
+class Converter {
+public:
+    explicit Converter(const qxf2qif_options *opts = nullptr) : cv_(qxf2qif_new(opts)) {}
+    ~Converter() { qxf2qif_free(cv_); }
+    Converter(const Converter &) = delete;
+    Converter &operator=(const Converter &) = delete;
+
+    bool valid() const { return cv_ != nullptr; }
+
+    /* Convert ofx[0, len), replacing the contents of qif */
+    int convert(const char *ofx, size_t len, std::string *qif) {
+        qif->clear();
+        return qxf2qif_convert(cv_, ofx, len, append, qif);
+    }
+    int convert(const std::string &ofx, std::string *qif) {
+        return convert(ofx.data(), ofx.size(), qif);
+    }
+    int convert_file(const char *in_path, const char *out_path) {
+        return qxf2qif_convert_file(cv_, in_path, out_path);
+    }
+
+    long transactions() const { return qxf2qif_transactions(cv_); }
+    bool memos_excluded() const { return qxf2qif_memos_excluded(cv_) != 0; }
+    qxf2qif_converter *handle() { return cv_; }
+
+private:
+    static int append(void *user, const char *data, size_t len) {
+        try {
+            static_cast<std::string *>(user)->append(data, len);
+        } catch (...) {
+            return 1;
+        }
+        return 0;
+    }
+
+    qxf2qif_converter *cv_;
+};
+
+} /* namespace qxf2qif */
+#endif
+
+#endif /* QXF2QIF_H */
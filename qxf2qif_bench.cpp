@@ -0,0 +1,506 @@
+/*
+ * qxf2qif_bench.cpp
+ *
+ * Benchmarks for the converter hot path, run over synthetic QFX input.
+ *
+ * The generator is deterministic: the same options always produce the
+ * same bytes, so results from different builds are comparable. Each
+ * benchmark is run several times and the fastest run is reported, as CSV
+ * or JSON, for tracking regressions.
+ *
+ * Usage: qxf2qif_bench [options]      (see usage())
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "qxf2qif_internal.h"
+
+using namespace qxf2qif::detail;
+
+/* Shape of the generated input */
+typedef struct {
+    size_t   transactions;  /* in total, over all statements */
+    int      statements;    /* <STMTRS> aggregates the transactions are spread over */
+    bool     short_tags;    /* omit the optional end tags of elements */
+    double   memo_rate;     /* fraction of transactions with a <MEMO> */
+    bool     crlf;          /* CR LF line ends instead of LF */
+    uint32_t seed;
+} GenOptions;
+
+/* xorshift32: tiny, and identical on every platform */
+static uint32_t gen_rand(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static const char *const gen_payees[] = {
+    "Coffee Shop", "SUPERMARKET #1042", "Payroll  ACME Corp", "Gas Station 88",
+    "Online Transfer to Savings", "Caf\xe9 Ren\xe9", "Electric Utility Co",
+    "Pharmacy 0231 - Main St", "Restaurant", "ATM Withdrawal"
+};
+#define GEN_PAYEES (sizeof(gen_payees) / sizeof(gen_payees[0]))
+
+static void gen_line(std::string *out, const GenOptions *go, const char *text) {
+    out->append(text);
+    out->append(go->crlf ? "\r\n" : "\n");
+}
+
+/* Append <tag>value, with </tag> unless short tags were requested */
+static void gen_element(std::string *out, const GenOptions *go, const char *tag, const char *value) {
+    std::string line = std::string("<") + tag + ">" + value;
+    if (!go->short_tags) line += std::string("</") + tag + ">";
+    gen_line(out, go, line.c_str());
+}
+
+static void gen_transaction(std::string *out, const GenOptions *go, uint32_t *rng, size_t index) {
+    char date[32], amount[32], fitid[32];
+    uint32_t r = gen_rand(rng);
+    int month = 1 + (int)(r % 12), day = 1 + (int)(r / 12 % 28);
+
+    /* the date forms seen in real exports: bare day, local time, and
+       time with milliseconds and a zone */
+    switch (r / 336 % 3) {
+    case 0: snprintf(date, sizeof(date), "2025%02d%02d", month, day); break;
+    case 1: snprintf(date, sizeof(date), "2025%02d%02d120000", month, day); break;
+    default: snprintf(date, sizeof(date), "2025%02d%02d083015.000[-5:EST]", month, day); break;
+    }
+
+    r = gen_rand(rng);
+    long cents = (long)(r % 500000);
+    bool credit = r % 4 == 0;
+    if (cents >= 100000 && r % 8 == 1) {
+        snprintf(amount, sizeof(amount), "%s%ld,%03ld.%02ld", credit ? "" : "-",
+                 cents / 100000, cents / 100 % 1000, cents % 100);
+    } else {
+        snprintf(amount, sizeof(amount), "%s%ld.%02ld", credit ? "" : "-", cents / 100, cents % 100);
+    }
+    snprintf(fitid, sizeof(fitid), "%08zu", index);
+
+    gen_line(out, go, "<STMTTRN>");
+    gen_element(out, go, "TRNTYPE", credit ? "CREDIT" : "DEBIT");
+    gen_element(out, go, "DTPOSTED", date);
+    gen_element(out, go, "TRNAMT", amount);
+    gen_element(out, go, "FITID", fitid);
+    gen_element(out, go, "NAME", gen_payees[gen_rand(rng) % GEN_PAYEES]);
+    if ((double)(gen_rand(rng) % 10000) < go->memo_rate * 10000) {
+        char memo[48];
+        snprintf(memo, sizeof(memo), "Reference %u", gen_rand(rng) % 1000000);
+        gen_element(out, go, "MEMO", memo);
+    }
+    gen_line(out, go, "</STMTTRN>");
+}
+
+/* Build a complete QFX document described by go */
+static std::string gen_qfx(const GenOptions *go) {
+    std::string out;
+    uint32_t rng = go->seed ? go->seed : 1;
+    int statements = go->statements > 0 ? go->statements : 1;
+    size_t index = 0;
+
+    out.reserve(go->transactions * 240 + 1024);
+    gen_line(&out, go, "OFXHEADER:100");
+    gen_line(&out, go, "DATA:OFXSGML");
+    gen_line(&out, go, "VERSION:102");
+    gen_line(&out, go, "ENCODING:USASCII");
+    gen_line(&out, go, "CHARSET:1252");
+    gen_line(&out, go, "");
+    gen_line(&out, go, "<OFX>");
+    gen_line(&out, go, "<BANKMSGSRSV1>");
+    for (int s = 0; s < statements; s++) {
+        char acct[16];
+        snprintf(acct, sizeof(acct), "%09d", 100000 + s);
+        gen_line(&out, go, "<STMTTRNRS>");
+        gen_element(&out, go, "TRNUID", "1");
+        gen_line(&out, go, "<STMTRS>");
+        gen_element(&out, go, "CURDEF", "USD");
+        gen_line(&out, go, "<BANKACCTFROM>");
+        gen_element(&out, go, "BANKID", "121000248");
+        gen_element(&out, go, "ACCTID", acct);
+        gen_element(&out, go, "ACCTTYPE", "CHECKING");
+        gen_line(&out, go, "</BANKACCTFROM>");
+        gen_line(&out, go, "<BANKTRANLIST>");
+        gen_element(&out, go, "DTSTART", "20250101");
+        gen_element(&out, go, "DTEND", "20251231");
+        size_t last = go->transactions * (size_t)(s + 1) / (size_t)statements;
+        for (; index < last; index++) gen_transaction(&out, go, &rng, index);
+        gen_line(&out, go, "</BANKTRANLIST>");
+        gen_line(&out, go, "</STMTRS>");
+        gen_line(&out, go, "</STMTTRNRS>");
+    }
+    gen_line(&out, go, "</BANKMSGSRSV1>");
+    gen_line(&out, go, "</OFX>");
+    return out;
+}
+
+/* One measured benchmark: the fastest of several runs */
+typedef struct {
+    std::string name;
+    size_t      bytes;      /* input bytes processed per run */
+    size_t      items;      /* operations (or transactions) per run */
+    double      seconds;
+} BenchResult;
+
+/* Keeps results observable so the compiler cannot drop the work */
+static volatile size_t bench_sink;
+
+static BenchResult bench_run(const char *name, size_t bytes, size_t items, int repeat,
+                             const std::function<size_t(void)> &body)
+{
+    BenchResult r;
+    r.name = name;
+    r.bytes = bytes;
+    r.items = items;
+    r.seconds = 0;
+    for (int i = 0; i < repeat; i++) {
+        double start = now_seconds();
+        bench_sink = bench_sink + body();
+        double t = now_seconds() - start;
+        if (i == 0 || t < r.seconds) r.seconds = t;
+    }
+    return r;
+}
+
+/* Transaction blocks of a document, as found by find_next_stmttrn() */
+typedef struct {
+    const char *begin, *end;
+} Block;
+
+static std::vector<Block> find_blocks(const std::string &doc) {
+    std::vector<Block> blocks;
+    const char *p = doc.data(), *end = doc.data() + doc.size();
+    Block b;
+    while (find_next_stmttrn(p, end, &b.begin, &b.end)) {
+        blocks.push_back(b);
+        p = b.end;
+    }
+    return blocks;
+}
+
+static void bench_micro(const std::string &doc, int repeat, std::vector<BenchResult> *results) {
+    std::vector<Block> blocks = find_blocks(doc);
+    static const char *const tags[] = { "DTPOSTED", "TRNAMT", "NAME", "MEMO" };
+    const size_t ntags = sizeof(tags) / sizeof(tags[0]);
+
+    /* the needle is absent, so every run scans the whole document */
+    results->push_back(bench_run("strcasestr_simple", doc.size(), 1, repeat, [&] {
+        return (size_t)(strcasestr_simple(doc.c_str(), "</bankmsgsrsv2>") != NULL);
+    }));
+
+    results->push_back(bench_run("extract_tag_content", doc.size(), blocks.size() * ntags, repeat, [&] {
+        char field[MAX_FIELD];
+        size_t sum = 0;
+        for (const Block &b : blocks) {
+            for (size_t k = 0; k < ntags; k++) {
+                extract_tag_content(b.begin, b.end, tags[k], field, sizeof(field));
+                sum += (unsigned char)field[0];
+            }
+        }
+        return sum;
+    }));
+
+    /* inputs for the field-level functions, as the original converter
+       saw them: untrimmed values copied out of each block */
+    std::vector<std::string> names, dates, amounts;
+    for (const Block &b : blocks) {
+        char field[MAX_FIELD];
+        extract_tag_content(b.begin, b.end, "NAME", field, sizeof(field));
+        names.push_back(std::string("  ") + field + " \r\n");
+        extract_tag_content(b.begin, b.end, "DTPOSTED", field, sizeof(field));
+        trim_inplace(field);
+        dates.push_back(field);
+        extract_tag_content(b.begin, b.end, "TRNAMT", field, sizeof(field));
+        trim_inplace(field);
+        amounts.push_back(field);
+    }
+
+    size_t name_bytes = 0;
+    for (const std::string &s : names) name_bytes += s.size();
+    results->push_back(bench_run("trim_inplace", name_bytes, names.size(), repeat, [&] {
+        char work[MAX_FIELD];
+        size_t sum = 0;
+        for (const std::string &s : names) {
+            memcpy(work, s.c_str(), s.size() + 1);
+            trim_inplace(work);
+            sum += (unsigned char)work[0];
+        }
+        return sum;
+    }));
+
+    size_t date_bytes = 0;
+    for (const std::string &s : dates) date_bytes += s.size();
+    results->push_back(bench_run("ofxdate_to_mmddyyyy", date_bytes, dates.size(), repeat, [&] {
+        char out[16];
+        size_t sum = 0;
+        for (const std::string &s : dates) sum += (size_t)ofxdate_to_mmddyyyy(s.c_str(), out, sizeof(out));
+        return sum;
+    }));
+
+    size_t amount_bytes = 0;
+    for (const std::string &s : amounts) amount_bytes += s.size();
+    results->push_back(bench_run("amount_parse_format", amount_bytes, amounts.size(), repeat, [&] {
+        char out[AMOUNT_TEXT_MAX];
+        size_t sum = 0;
+        for (const std::string &s : amounts) {
+            int64_t cents;
+            if (amount_parse(s.data(), s.size(), &cents)) sum += amount_format(cents, out);
+        }
+        return sum;
+    }));
+}
+
+/* Convert doc into memory, as the program does for a mapped input.
+ * Returns the number of transactions written.
+ */
+static size_t convert_doc(const std::string &doc, int threads, bool memo) {
+    ConvertOptions opts;
+    ConvertCounts counts = ConvertCounts();
+    OutBuf out;
+    OutputSet outs = {};
+    opts.formats = FORMAT_BIT(FORMAT_QIF);
+    opts.memo = memo;
+    opts.stats = false;
+    opts.date_layout = NULL;
+    opts.raw_text = false;
+    opts.transcode = NULL;
+    opts.xml = false;
+    opts.seen = NULL;
+    if (!outbuf_init(&out, -1, outbuf_estimate(doc.size()))) return 0;
+    outs.buf[FORMAT_QIF] = &out;
+    ConvertOptions input;
+    convert_options_for_input(&opts, doc.data(), doc.size(), &input);
+    convert_parallel(doc.data(), doc.data() + doc.size(), threads, &input, &outs, NULL, &counts);
+    outbuf_free(&out);
+    return (size_t)counts.transactions;
+}
+
+static BenchResult bench_convert(const char *name, const std::string &doc, size_t transactions,
+                                 int threads, int repeat)
+{
+    return bench_run(name, doc.size(), transactions, repeat, [&] {
+        return convert_doc(doc, threads, true);
+    });
+}
+
+/* Number of input sizes in the scaling series, each twice the last */
+#define SCALING_STEPS 4
+
+/* Convert inputs of doubling size with rare memos, the shape that used to
+ * be quadratic. Returns the ratio of the per-transaction time of the
+ * largest input to that of the smallest; about 1 when conversion is linear.
+ */
+static double bench_scaling(const GenOptions *base, int threads, int repeat,
+                            std::vector<BenchResult> *results)
+{
+    double first = 0, last = 0;
+    for (int step = 0; step < SCALING_STEPS; step++) {
+        GenOptions go = *base;
+        go.transactions = base->transactions >> (SCALING_STEPS - 1 - step);
+        if (go.transactions == 0) go.transactions = 1;
+        go.memo_rate = 0.02;
+        std::string doc = gen_qfx(&go);
+        char name[64];
+        snprintf(name, sizeof(name), "scaling_%zu", go.transactions);
+        BenchResult r = bench_convert(name, doc, go.transactions, threads, repeat);
+        double per_item = r.seconds / (double)r.items;
+        if (step == 0) first = per_item;
+        last = per_item;
+        results->push_back(r);
+    }
+    return first > 0 ? last / first : 0;
+}
+
+static void write_csv(FILE *f, const std::vector<BenchResult> &results) {
+    fprintf(f, "benchmark,bytes,items,seconds,mb_per_s,items_per_s,ns_per_item\n");
+    for (const BenchResult &r : results) {
+        double s = r.seconds > 0 ? r.seconds : 1e-9;
+        fprintf(f, "%s,%zu,%zu,%.9f,%.2f,%.0f,%.2f\n", r.name.c_str(), r.bytes, r.items, r.seconds,
+                (double)r.bytes / 1e6 / s, (double)r.items / s, s * 1e9 / (double)r.items);
+    }
+}
+
+static void write_json(FILE *f, const GenOptions *go, int threads, int repeat, double scaling,
+                       const std::vector<BenchResult> &results)
+{
+    fprintf(f, "{\n");
+    fprintf(f, "  \"config\": {\"transactions\": %zu, \"statements\": %d, \"short_tags\": %s, "
+               "\"memo_rate\": %.3f, \"crlf\": %s, \"seed\": %u, \"threads\": %d, \"repeat\": %d},\n",
+            go->transactions, go->statements, go->short_tags ? "true" : "false", go->memo_rate,
+            go->crlf ? "true" : "false", go->seed, threads, repeat);
+    fprintf(f, "  \"scaling_ratio\": %.3f,\n", scaling);
+    fprintf(f, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &r = results[i];
+        double s = r.seconds > 0 ? r.seconds : 1e-9;
+        fprintf(f, "    {\"benchmark\": \"%s\", \"bytes\": %zu, \"items\": %zu, \"seconds\": %.9f, "
+                   "\"mb_per_s\": %.2f, \"items_per_s\": %.0f, \"ns_per_item\": %.2f}%s\n",
+                r.name.c_str(), r.bytes, r.items, r.seconds, (double)r.bytes / 1e6 / s,
+                (double)r.items / s, s * 1e9 / (double)r.items, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+/* Largest acceptable scaling ratio for --check; a quadratic pass would
+ * give about 2^(SCALING_STEPS-1) = 8 */
+#define SCALING_LIMIT 2.0
+
+/* getopt codes for long-only options */
+enum {
+    OPT_SHORT_TAGS = 256,
+    OPT_MEMO_RATE,
+    OPT_CRLF,
+    OPT_SEED,
+    OPT_CHECK
+};
+
+static void usage(const char *prog, const char *extraLine = (const char *)(NULL))
+{
+    fprintf(stderr, "usage: %s <options>\n", prog);
+    fprintf(stderr, "-n --transactions N       transactions in the generated input (default 100000)\n");
+    fprintf(stderr, "-s --statements N         statements to spread them over (default 1)\n");
+    fprintf(stderr, "   --short-tags           omit optional end tags such as </NAME>\n");
+    fprintf(stderr, "   --memo-rate R          fraction of transactions with a memo (default 0.5)\n");
+    fprintf(stderr, "   --crlf                 CR LF line ends\n");
+    fprintf(stderr, "   --seed N               generator seed (default 1)\n");
+    fprintf(stderr, "-r --repeat N             runs per benchmark; the fastest counts (default 5)\n");
+    fprintf(stderr, "-t --threads N            threads for the conversion benchmarks (default 1)\n");
+    fprintf(stderr, "-f --format csv|json      result format (default csv)\n");
+    fprintf(stderr, "-o --output FILE          write results to FILE instead of stdout\n");
+    fprintf(stderr, "-g --generate FILE        only write the generated input to FILE\n");
+    fprintf(stderr, "   --check                fail unless conversion time grows linearly\n");
+    fprintf(stderr, "                          with input size\n");
+    if (extraLine) fprintf(stderr, "\n%s\n", extraLine);
+}
+
+int main(int argc, char *argv[])
+{
+    int         opt;
+    GenOptions  go = {100000, 1, false, 0.5, false, 1};
+    int         repeat = 5;
+    int         threads = 1;
+    bool        json = false;
+    bool        check = false;
+    const char  *outName = NULL;
+    const char  *genName = NULL;
+
+    struct option longOptions[] =
+        {
+            {"transactions", required_argument,  0,      'n'}
+            ,{"statements",  required_argument,  0,      's'}
+            ,{"short-tags",  no_argument,        0,      OPT_SHORT_TAGS}
+            ,{"memo-rate",   required_argument,  0,      OPT_MEMO_RATE}
+            ,{"crlf",        no_argument,        0,      OPT_CRLF}
+            ,{"seed",        required_argument,  0,      OPT_SEED}
+            ,{"repeat",      required_argument,  0,      'r'}
+            ,{"threads",     required_argument,  0,      't'}
+            ,{"format",      required_argument,  0,      'f'}
+            ,{"output",      required_argument,  0,      'o'}
+            ,{"generate",    required_argument,  0,      'g'}
+            ,{"check",       no_argument,        0,      OPT_CHECK}
+            ,{0,0,0,0}
+        };
+
+    while (1)
+    {
+        int optionIndex = 0;
+        opt = getopt_long(argc, argv, "n:s:r:t:f:o:g:", longOptions, &optionIndex);
+
+        if (-1 == opt) break;
+
+        switch (opt)
+        {
+        case 'n':
+            go.transactions = (size_t)strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            go.statements = atoi(optarg);
+            break;
+        case OPT_SHORT_TAGS:
+            go.short_tags = true;
+            break;
+        case OPT_MEMO_RATE:
+            go.memo_rate = atof(optarg);
+            break;
+        case OPT_CRLF:
+            go.crlf = true;
+            break;
+        case OPT_SEED:
+            go.seed = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            repeat = atoi(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'f':
+            if (strcmp(optarg, "json") == 0) json = true;
+            else if (strcmp(optarg, "csv") == 0) json = false;
+            else { usage(argv[0], "Unknown format"); return -1; }
+            break;
+        case 'o':
+            outName = optarg;
+            break;
+        case 'g':
+            genName = optarg;
+            break;
+        case OPT_CHECK:
+            check = true;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (go.transactions == 0 || go.statements <= 0 || repeat <= 0 || threads <= 0)
+    {
+        usage(argv[0], "Counts must be positive");
+        return -1;
+    }
+
+    std::string doc = gen_qfx(&go);
+
+    if (genName)
+    {
+        FILE *f = fopen(genName, "wb");
+        if (!f || fwrite(doc.data(), 1, doc.size(), f) != doc.size() || fclose(f) != 0)
+        {
+            fprintf(stderr, "Error writing %s\n", genName);
+            return -6;
+        }
+        return 0;
+    }
+
+    std::vector<BenchResult> results;
+    bench_micro(doc, repeat, &results);
+    results.push_back(bench_convert("convert", doc, go.transactions, threads, repeat));
+    double scaling = bench_scaling(&go, threads, repeat, &results);
+
+    FILE *f = outName ? fopen(outName, "w") : stdout;
+    if (!f)
+    {
+        fprintf(stderr, "Error opening %s\n", outName);
+        return -5;
+    }
+    if (json) write_json(f, &go, threads, repeat, scaling, results);
+    else write_csv(f, results);
+    if (f != stdout) fclose(f);
+
+    if (check && scaling > SCALING_LIMIT)
+    {
+        fprintf(stderr, "Conversion does not scale linearly: per-transaction time grew %.2fx\n", scaling);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,1010 @@
+/*
+ * qxf2qif_cli.cpp
+ *
+ * Conversion of whole files for the qxf2qif program: outputs opened by
+ * name, the date-ordered merge of several inputs and the --summary
+ * report. Built into an internal static library with the converter; not
+ * part of the installed libqxf2qif.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "qxf2qif_cli.h"
+
+namespace qxf2qif::detail {
+
+int file_fail(FileResult *res, int status, const char *error) {
+    res->status = status;
+    res->error = error;
+    return status;
+}
+
+/* Create outNames[f] for every format f in formats, each with a buffer of
+ * cap bytes, into out and outs.
+ * Returns 1 on success, 0 if one cannot be created; then none are open.
+ */
+static int outputs_open(const char *const outNames[FORMAT_COUNT], unsigned formats, size_t cap,
+                        PhaseTimes *pt, OutBuf out[FORMAT_COUNT], OutputSet *outs)
+{
+    bool opened = true;
+    outs->summary = NULL;
+    outs->collect = NULL;
+    for (int f = 0; f < FORMAT_COUNT; f++) {
+        outs->buf[f] = NULL;
+        if (!(formats & FORMAT_BIT(f)) || !opened) continue;
+        int fd = open(outNames[f], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) {
+            opened = false;
+        } else if (!outbuf_init(&out[f], fd, cap)) {
+            close(fd);
+            opened = false;
+        } else {
+            outs->buf[f] = &out[f];
+            out[f].times = pt;
+        }
+    }
+    if (!opened) {
+        for (int f = 0; f < FORMAT_COUNT; f++) {
+            if (!outs->buf[f]) continue;
+            close(out[f].fd);
+            outbuf_free(&out[f]);
+        }
+    }
+    return opened;
+}
+
+/* Flush and close the outputs opened by outputs_open().
+ * Returns 1 if everything was written, 0 otherwise.
+ */
+static int outputs_close(OutBuf out[FORMAT_COUNT], const OutputSet *outs) {
+    int written = 1;
+    for (int f = 0; f < FORMAT_COUNT; f++) {
+        if (!outs->buf[f]) continue;
+        if (!outbuf_flush(&out[f])) written = 0;
+        if (close(out[f].fd) != 0) written = 0;
+        outbuf_free(&out[f]);
+    }
+    return written;
+}
+
+/* Convert inName to outNames[f] for every format f in fo->convert.formats */
+int convert_file(const char *inName, const char *const outNames[FORMAT_COUNT],
+                 const FileOptions *fo, FileResult *res)
+{
+    double start = now_seconds();
+    res->status = 0;
+    res->error = NULL;
+    res->counts = ConvertCounts();
+    res->bytes_in = 0;
+    res->seconds = 0;
+    res->summary = NULL;
+    if (fo->summary && !(res->summary = summary_new()))
+        return file_fail(res, QXF2QIF_ERR_NOMEM, qxf2qif_strerror(QXF2QIF_ERR_NOMEM));
+
+    InputBuffer in = {NULL, 0, 0};
+    FILE *fin = NULL;
+    PhaseTimes *pt = fo->convert.stats ? &res->counts.phases : NULL;
+    double cpu = pt ? thread_cpu_seconds() : 0;
+    if (fo->stream) {
+        fin = fopen(inName, "rb");
+        if (!fin) return file_fail(res, QXF2QIF_ERR_READ, qxf2qif_strerror(QXF2QIF_ERR_READ));
+    } else if (!input_open(inName, fo->populate, &in)) {
+        return file_fail(res, QXF2QIF_ERR_READ, qxf2qif_strerror(QXF2QIF_ERR_READ));
+    }
+    if (pt) {
+        pt->wall[PHASE_READ] += now_seconds() - start;
+        pt->cpu[PHASE_READ] += thread_cpu_seconds() - cpu;
+    }
+
+    OutBuf out[FORMAT_COUNT];
+    OutputSet outs;
+    if (!outputs_open(outNames, fo->convert.formats, fin ? STREAM_CHUNK : outbuf_estimate(in.len),
+                      pt, out, &outs)) {
+        if (fin) fclose(fin);
+        input_close(&in);
+        return file_fail(res, QXF2QIF_ERR_OPEN, qxf2qif_strerror(QXF2QIF_ERR_OPEN));
+    }
+    outs.summary = res->summary;
+
+    /* verbose per-transaction listing on stdout */
+    OutBuf listing;
+    bool listFlag = fo->listing && outbuf_init(&listing, STDOUT_FILENO, OUTBUF_MIN);
+    if (listFlag) listing.times = pt;
+
+    int converted = 1;
+    int failure = QXF2QIF_ERR_NOMEM;    /* status if not converted */
+    ConvertOptions opts;
+    if (fin) {
+        converted = convert_stream(fin, &outs, listFlag ? &listing : NULL, &fo->convert, &res->counts);
+        if (ferror(fin)) failure = QXF2QIF_ERR_READ;
+        res->bytes_in = (size_t)ftello(fin);
+        fclose(fin);
+    } else {
+        convert_options_for_input(&fo->convert, in.data, in.len, &opts);
+        converted = convert_parallel(in.data, in.data + in.len, fo->threads, &opts,
+                                     &outs, listFlag ? &listing : NULL, &res->counts);
+        res->bytes_in = in.len;
+        input_close(&in);
+    }
+
+    int written = outputs_close(out, &outs);
+    bool summarised = !res->summary || !summary_failed(res->summary);
+    if (listFlag) {
+        outbuf_flush(&listing);
+        outbuf_free(&listing);
+    }
+    res->seconds = now_seconds() - start;
+    /* the transactions written are seen only once the file is complete */
+    SeenIndex *seen = fo->convert.seen;
+    if (seen && (!converted || !written || !summarised)) seen_discard(seen);
+    if (!converted) return file_fail(res, failure, qxf2qif_strerror(failure));
+    if (!written) return file_fail(res, QXF2QIF_ERR_WRITE, qxf2qif_strerror(QXF2QIF_ERR_WRITE));
+    if (!summarised) return file_fail(res, QXF2QIF_ERR_NOMEM, qxf2qif_strerror(QXF2QIF_ERR_NOMEM));
+    if (seen && !seen_commit(seen)) {
+        seen_discard(seen);
+        return file_fail(res, QXF2QIF_ERR_WRITE, "Cannot update the seen index");
+    }
+    return 0;
+}
+
+/*
+ * Transaction table.
+ *
+ * Parsed transactions kept column by column: contiguous arrays of packed
+ * dates, times, amounts and small ids, with text (payees, memos, FITIDs)
+ * in an arena. Payees and accounts are interned, so repeated names are
+ * stored once and compare as integers. Sorting and other passes over a
+ * file's transactions run over these arrays instead of the OFX text.
+ */
+
+enum {
+    TABLE_DATED  = 1,       /* date and time are valid */
+    TABLE_PARSED = 2        /* cents is valid */
+};
+
+struct TxnTable {
+    std::vector<int32_t>      date;       /* YYYYMMDD */
+    std::vector<int32_t>      time;       /* milliseconds after midnight */
+    std::vector<int64_t>      cents;
+    std::vector<uint32_t>     payee;      /* index into payees */
+    std::vector<uint32_t>     account;    /* index into accounts */
+    std::vector<uint8_t>      flags;      /* TABLE_* */
+    std::vector<const char *> memo;       /* text_put() strings, NULL if empty */
+    std::vector<const char *> fitid;
+    std::vector<const char *> raw_date;   /* DTPOSTED as sent if it did not parse */
+    std::vector<const char *> raw_amount; /* TRNAMT as sent if it did not parse */
+    NameIndex                 payees;     /* interned NAME text */
+    std::vector<QifSection>   accounts;   /* interned statement accounts */
+    Arena                     arena;      /* all text */
+    bool                      error;      /* out of memory; rows are missing */
+};
+
+TxnTable *table_new(void) {
+    TxnTable *t = new (std::nothrow) TxnTable;
+    if (!t) return NULL;
+    arena_init(&t->arena);
+    t->error = false;
+    return t;
+}
+
+void table_free(TxnTable *t) {
+    if (!t) return;
+    arena_free(&t->arena);
+    delete t;
+}
+
+/* Empty t, keeping its memory for the next file */
+void table_reset(TxnTable *t) {
+    t->date.clear();
+    t->time.clear();
+    t->cents.clear();
+    t->payee.clear();
+    t->account.clear();
+    t->flags.clear();
+    t->memo.clear();
+    t->fitid.clear();
+    t->raw_date.clear();
+    t->raw_amount.clear();
+    names_clear(&t->payees);
+    t->accounts.clear();
+    arena_reset(&t->arena);
+    t->error = false;
+}
+
+size_t table_rows(const TxnTable *t) {
+    return t->date.size();
+}
+
+/* Bytes held by t */
+size_t table_bytes(const TxnTable *t) {
+    return t->date.capacity() * (2 * sizeof(int32_t) + sizeof(int64_t) + 2 * sizeof(uint32_t)
+                                 + sizeof(uint8_t) + 4 * sizeof(const char *))
+           + arena_used(&t->arena);
+}
+
+/* Index of the account of sec, added if new */
+static uint32_t table_account(TxnTable *t, const QifSection *sec) {
+    for (size_t k = t->accounts.size(); k-- > 0; ) {
+        const QifSection &a = t->accounts[k];
+        if (a.type == sec->type && strcmp(a.acctid, sec->acctid) == 0) return (uint32_t)k;
+    }
+    QifSection a;
+    qif_begin(&a, SECTION_OPEN);
+    a.type = sec->type;
+    memcpy(a.acctid, sec->acctid, sizeof(a.acctid));
+    t->accounts.push_back(a);
+    return (uint32_t)(t->accounts.size() - 1);
+}
+
+/* OutputSet collect hook: append r as a row of the TxnTable user */
+void table_collect(void *user, const Record *r) {
+    TxnTable *t = (TxnTable *)user;
+    try {
+        const OfxDateTime *d = &r->dt;
+        t->date.push_back(r->dated ? (int32_t)d->year * 10000 + d->month * 100 + d->day : 0);
+        t->time.push_back(r->dated ? ((d->hour * 60 + d->minute) * 60 + d->second) * 1000 + d->millis : 0);
+        t->cents.push_back(r->parsed ? r->cents : 0);
+        t->flags.push_back((r->dated ? TABLE_DATED : 0) | (r->parsed ? TABLE_PARSED : 0));
+        t->payee.push_back(names_intern(&t->payees, &t->arena, &t->error, r->name, r->name_len));
+        t->account.push_back(table_account(t, r->account));
+        t->memo.push_back(text_put(&t->arena, &t->error, r->memo, r->memo_len));
+        t->fitid.push_back(text_put(&t->arena, &t->error, r->fitid, r->fitid_len));
+        t->raw_date.push_back(r->dated ? NULL
+                              : text_put(&t->arena, &t->error, r->raw_date, r->raw_date_len));
+        t->raw_amount.push_back(r->parsed ? NULL
+                                : text_put(&t->arena, &t->error, r->raw_amount, r->raw_amount_len));
+    } catch (const std::bad_alloc &) {
+        t->error = true;
+    }
+}
+
+int table_failed(const TxnTable *t) {
+    return t->error;
+}
+
+/* Row i of t as a Record, valid until t changes */
+void table_row(const TxnTable *t, size_t i, Record *r) {
+    int32_t date = t->date[i], time = t->time[i];
+    memset(&r->dt, 0, sizeof(r->dt));
+    r->dated = (t->flags[i] & TABLE_DATED) != 0;
+    if (r->dated) {
+        r->dt.year = (int16_t)(date / 10000);
+        r->dt.month = (int8_t)(date / 100 % 100);
+        r->dt.day = (int8_t)(date % 100);
+        r->dt.hour = (int8_t)(time / 3600000);
+        r->dt.minute = (int8_t)(time / 60000 % 60);
+        r->dt.second = (int8_t)(time / 1000 % 60);
+        r->dt.millis = (int16_t)(time % 1000);
+        r->dt.has_time = time != 0;
+    }
+    const char *raw_date = r->dated ? NULL : t->raw_date[i];
+    r->raw_date = text_ptr(raw_date);
+    r->raw_date_len = text_len(raw_date);
+    r->parsed = (t->flags[i] & TABLE_PARSED) != 0;
+    r->cents = t->cents[i];
+    const char *raw_amount = r->parsed ? NULL : t->raw_amount[i];
+    r->raw_amount = text_ptr(raw_amount);
+    r->raw_amount_len = text_len(raw_amount);
+    r->fitid = text_ptr(t->fitid[i]);
+    r->fitid_len = text_len(t->fitid[i]);
+    const char *name = t->payees.names[t->payee[i]];
+    r->name = text_ptr(name);
+    r->name_len = text_len(name);
+    r->memo = text_ptr(t->memo[i]);
+    r->memo_len = text_len(t->memo[i]);
+    r->account = &t->accounts[t->account[i]];
+}
+
+/* Start loading the columns of row i of t, about to be read out of order */
+static inline void table_prefetch(const TxnTable *t, size_t i) {
+    __builtin_prefetch(&t->date[i]);
+    __builtin_prefetch(&t->time[i]);
+    __builtin_prefetch(&t->cents[i]);
+    __builtin_prefetch(&t->flags[i]);
+    __builtin_prefetch(&t->payee[i]);
+    __builtin_prefetch(&t->account[i]);
+    __builtin_prefetch(&t->memo[i]);
+    __builtin_prefetch(&t->fitid[i]);
+}
+
+/* Start loading the text of row i, once its columns are in cache */
+static inline void table_prefetch_text(const TxnTable *t, size_t i) {
+    __builtin_prefetch(t->payees.names[t->payee[i]]);
+    __builtin_prefetch(t->memo[i]);
+    __builtin_prefetch(t->fitid[i]);
+}
+
+/* Fill order[0, rows) with the rows of t by posted date and time, rows
+ * with a date that did not parse last; equal dates keep file order */
+void table_order_by_date(const TxnTable *t, uint32_t *order) {
+    size_t n = table_rows(t);
+    std::vector<int64_t> key(n);
+    const int32_t *date = t->date.data(), *time = t->time.data();
+    const uint8_t *flags = t->flags.data();
+    for (size_t i = 0; i < n; i++) {
+        int64_t k = (int64_t)date[i] * 86400000 + time[i];
+        key[i] = (flags[i] & TABLE_DATED) ? k : INT64_MAX;
+    }
+    for (size_t i = 0; i < n; i++) order[i] = (uint32_t)i;
+    const int64_t *keys = key.data();
+    std::stable_sort(order, order + n, [keys](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+}
+
+/* Non-zero if any row of t belongs to a bank statement */
+int table_has_bank(const TxnTable *t) {
+    for (const QifSection &a : t->accounts)
+        if (a.type == ACCOUNT_BANK) return 1;
+    return 0;
+}
+
+/*
+ * Merging.
+ *
+ * Every input is converted into a TxnTable (through its collect hook)
+ * and ordered by posted date into runs. The tables being filled are
+ * charged against the memory limit as they grow. One that no longer fits
+ * is sorted and written to a temporary spill file as MergeRecords, and
+ * the input goes on in a new run; an input's last run stays in memory
+ * if it fits. The output is
+ * then a k-way merge of the runs on a heap, so it costs one pass over the
+ * spill files however many there are. Equal dates keep input order, and
+ * within an input, file order.
+ */
+enum {
+    MERGE_DATED  = 1,
+    MERGE_PARSED = 2,
+    MERGE_CCARD  = 4
+};
+
+/* A record in a spill file. The text follows it: ACCTID, raw date, raw
+ * amount, FITID, NAME, MEMO. size is a multiple of 8. */
+typedef struct {
+    uint32_t    size;
+    uint8_t     flags;          /* MERGE_* */
+    uint8_t     acctid_len;
+    uint8_t     raw_date_len;
+    uint8_t     reserved;
+    int64_t     cents;
+    OfxDateTime dt;
+    uint32_t    raw_amount_len, fitid_len, name_len, memo_len;
+} MergeRecord;
+
+struct MergeRun {
+    size_t                input;    /* position of the input; breaks date ties */
+    size_t                part;     /* runs of the same input before this one */
+    TxnTable             *table;    /* while in memory */
+    std::vector<uint32_t> order;    /* rows of table by date */
+    size_t                next;
+    FILE                 *spill;    /* the sorted records, if spilled */
+    std::vector<uint64_t> current;  /* the record last read from spill */
+    QifSection            account;  /* its account */
+    bool                  has_head;
+    Record                head;     /* the run's next record in the merge */
+    int64_t               key;      /* record_key() of head */
+    bool                  error;    /* reading the spill file failed */
+};
+
+/* Pack r into buf as a MergeRecord; returns it */
+static const MergeRecord *merge_pack(const Record *r, std::vector<uint64_t> *buf) {
+    size_t acctid_len = strlen(r->account->acctid);
+    size_t text = acctid_len + r->raw_date_len + r->raw_amount_len + r->fitid_len
+                  + r->name_len + r->memo_len;
+    size_t size = (sizeof(MergeRecord) + text + 7) & ~(size_t)7;
+    buf->assign(size / 8, 0);
+    MergeRecord *m = (MergeRecord *)buf->data();
+    m->size = (uint32_t)size;
+    m->flags = (r->dated ? MERGE_DATED : 0) | (r->parsed ? MERGE_PARSED : 0)
+               | (r->account->type == ACCOUNT_CCARD ? MERGE_CCARD : 0);
+    m->acctid_len = (uint8_t)acctid_len;
+    m->raw_date_len = (uint8_t)r->raw_date_len;
+    m->cents = r->parsed ? r->cents : 0;
+    if (r->dated) m->dt = r->dt;
+    m->raw_amount_len = (uint32_t)r->raw_amount_len;
+    m->fitid_len = (uint32_t)r->fitid_len;
+    m->name_len = (uint32_t)r->name_len;
+    m->memo_len = (uint32_t)r->memo_len;
+    char *p = (char *)(m + 1);
+    memcpy(p, r->account->acctid, acctid_len);
+    p += acctid_len;
+    memcpy(p, r->raw_date, r->raw_date_len);
+    p += r->raw_date_len;
+    memcpy(p, r->raw_amount, r->raw_amount_len);
+    p += r->raw_amount_len;
+    memcpy(p, r->fitid, r->fitid_len);
+    p += r->fitid_len;
+    memcpy(p, r->name, r->name_len);
+    p += r->name_len;
+    memcpy(p, r->memo, r->memo_len);
+    return m;
+}
+
+/* Rebuild the Record (and its account) that m holds */
+static void merge_unpack(const MergeRecord *m, Record *rec, QifSection *account) {
+    const char *p = (const char *)(m + 1);
+    qif_begin(account, SECTION_OPEN);
+    account->type = (m->flags & MERGE_CCARD) ? ACCOUNT_CCARD : ACCOUNT_BANK;
+    memcpy(account->acctid, p, m->acctid_len);
+    account->acctid[m->acctid_len] = '\0';
+    p += m->acctid_len;
+    rec->dt = m->dt;
+    rec->dated = (m->flags & MERGE_DATED) != 0;
+    rec->raw_date = p;
+    rec->raw_date_len = m->raw_date_len;
+    p += m->raw_date_len;
+    rec->parsed = (m->flags & MERGE_PARSED) != 0;
+    rec->cents = m->cents;
+    rec->raw_amount = p;
+    rec->raw_amount_len = m->raw_amount_len;
+    p += m->raw_amount_len;
+    rec->fitid = p;
+    rec->fitid_len = m->fitid_len;
+    p += m->fitid_len;
+    rec->name = p;
+    rec->name_len = m->name_len;
+    p += m->name_len;
+    rec->memo = p;
+    rec->memo_len = m->memo_len;
+    rec->account = account;
+}
+
+/* A table emptied after its run spilled, kept for the next input */
+typedef struct {
+    TxnTable *table;
+    size_t    charged;      /* bytes of Merger.retained it holds */
+} MergeSpare;
+
+struct Merger {
+    size_t                  memory_limit;
+    bool                    dedup;
+    std::mutex              lock;       /* guards everything below */
+    size_t                  retained;   /* bytes charged: runs kept in memory,
+                                           tables being filled and spares */
+    std::vector<MergeRun *> runs;
+    std::vector<MergeSpare> spare;
+    int                     spilled;
+    bool                    bank;       /* a bank record was seen */
+    ConvertCounts           counts;
+};
+
+Merger *merger_new(size_t memory_limit, bool dedup) {
+    Merger *m = new (std::nothrow) Merger;
+    if (!m) return NULL;
+    m->memory_limit = memory_limit;
+    m->dedup = dedup;
+    m->retained = 0;
+    m->spilled = 0;
+    m->bank = false;
+    m->counts = ConvertCounts();
+    return m;
+}
+
+static void merge_run_free(MergeRun *run) {
+    if (run->spill) fclose(run->spill);
+    table_free(run->table);
+    delete run;
+}
+
+void merger_free(Merger *m) {
+    if (!m) return;
+    for (MergeRun *run : m->runs) merge_run_free(run);
+    for (MergeSpare &spare : m->spare) table_free(spare.table);
+    delete m;
+}
+
+int merger_spilled(const Merger *m) {
+    return m->spilled;
+}
+
+/* Bytes a run of table needs once ordered, counting the sort keys */
+static size_t merge_run_bytes(const TxnTable *table) {
+    return table_bytes(table) + table_rows(table) * (sizeof(uint32_t) + sizeof(int64_t));
+}
+
+/* Raise a charge of *charged bytes against m's memory limit to need,
+ * releasing spare tables to make room. force charges it even past the
+ * limit. Returns 1 if charged, 0 if it does not fit. */
+static int merge_charge(Merger *m, size_t *charged, size_t need, bool force) {
+    if (need <= *charged) return 1;
+    size_t more = need - *charged;
+    std::lock_guard<std::mutex> l(m->lock);
+    while (m->retained + more > m->memory_limit && !m->spare.empty()) {
+        m->retained -= m->spare.back().charged;
+        table_free(m->spare.back().table);
+        m->spare.pop_back();
+    }
+    if (!force && m->retained + more > m->memory_limit) return 0;
+    m->retained += more;
+    *charged = need;
+    return 1;
+}
+
+/* Give back a charge */
+static void merge_uncharge(Merger *m, size_t *charged) {
+    std::lock_guard<std::mutex> l(m->lock);
+    m->retained -= *charged;
+    *charged = 0;
+}
+
+/* Write run's records to a temporary file in date order. The table is
+ * left to the caller. Returns 1 on success, 0 on error. */
+static int merge_run_spill(MergeRun *run) {
+    run->spill = tmpfile();
+    if (!run->spill) return 0;
+    setvbuf(run->spill, NULL, _IOFBF, STREAM_CHUNK);
+    for (uint32_t row : run->order) {
+        Record r;
+        table_row(run->table, row, &r);
+        const MergeRecord *m = merge_pack(&r, &run->current);
+        fwrite(m, 1, m->size, run->spill);
+    }
+    if (fflush(run->spill) != 0 || ferror(run->spill)) return 0;
+    rewind(run->spill);
+    std::vector<uint32_t>().swap(run->order);
+    return 1;
+}
+
+/* A table being filled for some run always gets this much, even past the
+ * memory limit, so that an input arriving with the budget spent still
+ * spills in runs of a useful size */
+#define MERGE_RUN_MIN (8 * 1024 * 1024)
+
+/* Rows collected between checks of a table's size against its charge */
+#define MERGE_CHARGE_ROWS 1024
+
+/* An input being added to a Merger: the run its records are collected
+ * into and the part of the memory budget its table holds */
+typedef struct {
+    Merger   *m;
+    size_t    input;
+    size_t    parts;        /* runs of the input so far */
+    MergeRun *run;
+    size_t    charged;
+    int       status;       /* first failure, 0 if none */
+    const char *error;
+} MergeInput;
+
+/* Start the next run of mi, filling table */
+static int merge_input_run(MergeInput *mi, TxnTable *table) {
+    MergeRun *run = new (std::nothrow) MergeRun;
+    if (!run) return 0;
+    run->input = mi->input;
+    run->part = mi->parts++;
+    run->table = table;
+    run->next = 0;
+    run->spill = NULL;
+    run->has_head = false;
+    run->error = false;
+    mi->run = run;
+    return 1;
+}
+
+static void merge_input_fail(MergeInput *mi, int status, const char *error) {
+    if (mi->status) return;
+    mi->status = status;
+    mi->error = error;
+}
+
+/* Order the run mi is filling and hand it to the merger: kept in memory
+ * if it is the input's last and fits the budget, otherwise spilled.
+ * Unless last, the next run starts in the emptied table. */
+static void merge_input_end_run(MergeInput *mi, bool last) {
+    Merger *m = mi->m;
+    MergeRun *run = mi->run;
+    TxnTable *table = run->table;
+    if (table_failed(table)) {
+        merge_input_fail(mi, QXF2QIF_ERR_NOMEM, qxf2qif_strerror(QXF2QIF_ERR_NOMEM));
+        return;
+    }
+    try {
+        run->order.resize(table_rows(table));
+        table_order_by_date(table, run->order.data());
+    } catch (const std::bad_alloc &) {
+        merge_input_fail(mi, QXF2QIF_ERR_NOMEM, qxf2qif_strerror(QXF2QIF_ERR_NOMEM));
+        return;
+    }
+    bool keep = last && merge_charge(m, &mi->charged, merge_run_bytes(table), false);
+    if (!keep && !merge_run_spill(run)) {
+        merge_input_fail(mi, QXF2QIF_ERR_WRITE, "Cannot write a merge spill file");
+        return;
+    }
+    bool bank = table_has_bank(table);
+    if (keep) {
+        mi->charged = 0;    /* now held by the run */
+    } else {
+        run->table = NULL;
+        table_reset(table);
+    }
+    mi->run = NULL;
+    {
+        std::lock_guard<std::mutex> l(m->lock);
+        m->runs.push_back(run);
+        if (!keep) m->spilled++;
+        if (bank) m->bank = true;
+        if (last && !keep) {
+            m->spare.push_back({table, mi->charged});
+            mi->charged = 0;
+        }
+    }
+    if (last || keep) return;
+
+    /* the table kept what it grew to; start over if that is past its charge */
+    if (table_bytes(table) > mi->charged) {
+        table_free(table);
+        table = table_new();
+    }
+    if (!table || !merge_input_run(mi, table)) {
+        table_free(table);
+        merge_input_fail(mi, QXF2QIF_ERR_NOMEM, qxf2qif_strerror(QXF2QIF_ERR_NOMEM));
+    }
+}
+
+/* OutputSet collect hook of merger_add(): add r to the run being filled,
+ * spilling the run first once its table outgrows what the budget allows */
+static void merge_collect(void *user, const Record *r) {
+    MergeInput *mi = (MergeInput *)user;
+    if (mi->status) return;
+    TxnTable *table = mi->run->table;
+    table_collect(table, r);
+    if (table_rows(table) % MERGE_CHARGE_ROWS) return;
+    size_t need = merge_run_bytes(table);
+    if (!merge_charge(mi->m, &mi->charged, need, need <= MERGE_RUN_MIN)) merge_input_end_run(mi, false);
+}
+
+/* Convert inName and add its transactions to m as input number index.
+ * Tables being filled are charged against the memory limit along with
+ * the runs kept; a table that would go past it is sorted and spilled as
+ * a run of its own, so an input of any size fits. Safe to call from
+ * several threads at once. Returns 0 or a status as convert_file() does. */
+int merger_add(Merger *m, size_t index, const char *inName, const FileOptions *fo, FileResult *res) {
+    double start = now_seconds();
+    res->status = 0;
+    res->error = NULL;
+    res->counts = ConvertCounts();
+    res->bytes_in = 0;
+    res->seconds = 0;
+    res->summary = NULL;
+
+    InputBuffer in = {NULL, 0, 0};
+    if (!input_open(inName, fo->populate, &in))
+        return file_fail(res, QXF2QIF_ERR_READ, qxf2qif_strerror(QXF2QIF_ERR_READ));
+
+    MergeInput mi;
+    mi.m = m;
+    mi.input = index;
+    mi.parts = 0;
+    mi.run = NULL;
+    mi.charged = 0;
+    mi.status = 0;
+    mi.error = NULL;
+    TxnTable *table = NULL;
+    {
+        std::lock_guard<std::mutex> l(m->lock);
+        if (!m->spare.empty()) {
+            table = m->spare.back().table;
+            mi.charged = m->spare.back().charged;
+            m->spare.pop_back();
+        }
+    }
+    if (!table) table = table_new();
+    if (!table || !merge_input_run(&mi, table)) {
+        table_free(table);
+        merge_uncharge(m, &mi.charged);
+        input_close(&in);
+        return file_fail(res, QXF2QIF_ERR_NOMEM, qxf2qif_strerror(QXF2QIF_ERR_NOMEM));
+    }
+
+    ConvertOptions opts;
+    OutputSet outs = {};
+    outs.collect = merge_collect;
+    outs.collect_user = &mi;
+    convert_options_for_input(&fo->convert, in.data, in.len, &opts);
+    opts.seen = NULL;
+    int converted = convert_parallel(in.data, in.data + in.len, 1, &opts, &outs, NULL, &res->counts);
+    res->bytes_in = in.len;
+    input_close(&in);
+    if (!converted)
+        merge_input_fail(&mi, QXF2QIF_ERR_NOMEM, qxf2qif_strerror(QXF2QIF_ERR_NOMEM));
+    if (!mi.status) merge_input_end_run(&mi, true);
+    if (mi.status) {
+        if (mi.run) merge_run_free(mi.run);
+        merge_uncharge(m, &mi.charged);
+        return file_fail(res, mi.status, mi.error);
+    }
+    {
+        std::lock_guard<std::mutex> l(m->lock);
+        counts_add(&m->counts, &res->counts);
+    }
+    res->seconds = now_seconds() - start;
+    return 0;
+}
+
+/* Rows ahead of the merge whose columns are prefetched */
+#define MERGE_PREFETCH 16
+
+/* Move run->head to the run's next record; has_head is false at the end */
+static void merge_run_next(MergeRun *run) {
+    run->has_head = false;
+    if (!run->spill) {
+        if (run->next == run->order.size()) return;
+        if (run->next + MERGE_PREFETCH < run->order.size())
+            table_prefetch(run->table, run->order[run->next + MERGE_PREFETCH]);
+        if (run->next + MERGE_PREFETCH / 2 < run->order.size())
+            table_prefetch_text(run->table, run->order[run->next + MERGE_PREFETCH / 2]);
+        table_row(run->table, run->order[run->next++], &run->head);
+    } else {
+        uint32_t size;
+        if (fread(&size, sizeof(size), 1, run->spill) != 1) {
+            if (ferror(run->spill)) run->error = true;
+            return;
+        }
+        if (size < sizeof(MergeRecord)) {
+            run->error = true;
+            return;
+        }
+        run->current.resize((size + 7) / 8);
+        char *p = (char *)run->current.data();
+        memcpy(p, &size, sizeof(size));
+        if (fread(p + sizeof(size), 1, size - sizeof(size), run->spill) != size - sizeof(size)) {
+            run->error = true;
+            return;
+        }
+        merge_unpack((const MergeRecord *)p, &run->head, &run->account);
+    }
+    run->key = record_key(&run->head);
+    run->has_head = true;
+}
+
+/* Write every transaction added to m, by posted date, to outNames[f] for
+ * every format f in fo->convert.formats, under a single section header:
+ * !Type:CCard if all came from credit card statements, else !Type:Bank.
+ * With dedup, a transaction whose account and FITID were already written
+ * is dropped. Returns 0 or a status as convert_file() does.
+ */
+int merger_write(Merger *m, const char *const outNames[FORMAT_COUNT], const FileOptions *fo,
+                 FileResult *res)
+{
+    double start = now_seconds();
+    res->status = 0;
+    res->error = NULL;
+    res->counts = m->counts;
+    res->counts.transactions = 0;
+    res->bytes_in = 0;
+    res->seconds = 0;
+    res->summary = NULL;
+    if (fo->summary && !(res->summary = summary_new()))
+        return file_fail(res, QXF2QIF_ERR_NOMEM, qxf2qif_strerror(QXF2QIF_ERR_NOMEM));
+
+    OutBuf out[FORMAT_COUNT];
+    OutputSet outs;
+    if (!outputs_open(outNames, fo->convert.formats, outbuf_estimate(m->retained), NULL, out, &outs))
+        return file_fail(res, QXF2QIF_ERR_OPEN, qxf2qif_strerror(QXF2QIF_ERR_OPEN));
+
+    QifSection sec;
+    qif_begin(&sec, SECTION_PENDING);
+    if (!m->bank && !m->runs.empty()) sec.type = ACCOUNT_CCARD;
+    outputs_begin(&outs);
+    section_open(&sec, &outs);
+
+    /* a min-heap of the runs by their next record */
+    auto later = [](const MergeRun *a, const MergeRun *b) {
+        if (a->key != b->key) return a->key > b->key;
+        if (a->input != b->input) return a->input > b->input;
+        return a->part > b->part;
+    };
+    std::vector<MergeRun *> heap;
+    bool failed = false;
+    for (MergeRun *run : m->runs) {
+        merge_run_next(run);
+        if (run->error) failed = true;
+        if (run->has_head) heap.push_back(run);
+    }
+    std::make_heap(heap.begin(), heap.end(), later);
+
+    std::vector<uint64_t> written;     /* open-addressing set of (ACCTID, FITID) hashes */
+    size_t nwritten = 0;
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        MergeRun *run = heap.back();
+        const Record *rec = &run->head;
+
+        bool keep = true;
+        if (m->dedup && rec->fitid_len) {
+            if (written.size() < 2 * (nwritten + 1)) {
+                std::vector<uint64_t> grown(written.empty() ? 1024 : written.size() * 2, 0);
+                for (uint64_t h : written)
+                    if (h) *seen_probe(grown.data(), grown.size(), h) = h;
+                written.swap(grown);
+            }
+            const char *acctid = rec->account->acctid;
+            uint64_t h = seen_hash(acctid, strlen(acctid), rec->fitid, rec->fitid_len);
+            uint64_t *slot = seen_probe(written.data(), written.size(), h);
+            if (*slot == h) {
+                keep = false;
+                ++res->counts.duplicates;
+            } else {
+                *slot = h;
+                nwritten++;
+            }
+        }
+        if (keep) {
+            outputs_record(&outs, rec, &fo->convert);
+            if (res->summary) summary_add(res->summary, rec);
+            ++res->counts.transactions;
+        }
+
+        merge_run_next(run);
+        if (run->error) failed = true;
+        if (run->has_head) std::push_heap(heap.begin(), heap.end(), later);
+        else heap.pop_back();
+    }
+
+    int ok = outputs_close(out, &outs);
+    res->seconds = now_seconds() - start;
+    if (failed) return file_fail(res, QXF2QIF_ERR_READ, "Cannot read a merge spill file");
+    if (!ok) return file_fail(res, QXF2QIF_ERR_WRITE, qxf2qif_strerror(QXF2QIF_ERR_WRITE));
+    if (res->summary && summary_failed(res->summary))
+        return file_fail(res, QXF2QIF_ERR_NOMEM, qxf2qif_strerror(QXF2QIF_ERR_NOMEM));
+    return 0;
+}
+
+/*
+ * Summary output.
+ */
+
+int summary_style_parse(const char *name, int *style) {
+    if (name_is(name, "table")) *style = SUMMARY_TABLE;
+    else if (name_is(name, "json")) *style = SUMMARY_JSON;
+    else return 0;
+    return 1;
+}
+
+/* Payees by spend, most first, then by name; up to top of them */
+static std::vector<uint32_t> summary_top_payees(const Summary *s, int top) {
+    std::vector<uint32_t> ids(s->spend.size());
+    for (size_t id = 0; id < ids.size(); id++) ids[id] = (uint32_t)id;
+    size_t n = top < 0 ? 0 : std::min(ids.size(), (size_t)top);
+    std::partial_sort(ids.begin(), ids.begin() + n, ids.end(), [s](uint32_t a, uint32_t b) {
+        if (s->spend[a].spend != s->spend[b].spend) return s->spend[a].spend > s->spend[b].spend;
+        const char *x = s->payees.names[a], *y = s->payees.names[b];
+        size_t xl = text_len(x), yl = text_len(y);
+        int c = memcmp(text_ptr(x), text_ptr(y), std::min(xl, yl));
+        return c != 0 ? c < 0 : xl < yl;
+    });
+    ids.resize(n);
+    return ids;
+}
+
+/* Append the ISO date of dt */
+static void summary_date(OutBuf *out, const OfxDateTime *dt) {
+    char date[DATE_TEXT_MAX];
+    outbuf_put(out, date, date_layout_format(&iso_date_layout, dt, date));
+}
+
+static void summary_cents(OutBuf *out, int64_t cents) {
+    char amount[AMOUNT_TEXT_MAX];
+    outbuf_put(out, amount, amount_format(cents, amount));
+}
+
+/* printf() into out */
+static void summary_printf(OutBuf *out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void summary_printf(OutBuf *out, const char *fmt, ...) {
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n > 0) outbuf_put(out, line, std::min((size_t)n, sizeof(line) - 1));
+}
+
+static void summary_write_table(const Summary *s, int top, OutBuf *out) {
+    char credits[AMOUNT_TEXT_MAX + 1], debits[AMOUNT_TEXT_MAX + 1], net[AMOUNT_TEXT_MAX + 1];
+    auto text = [](char *buf, int64_t cents) {
+        buf[amount_format(cents, buf)] = '\0';
+        return buf;
+    };
+
+    summary_printf(out, "Transactions          : %d\n", s->transactions);
+    if (s->first <= s->last) {
+        OUTBUF_PUT_LIT(out, "First Date            : ");
+        summary_date(out, &s->first_dt);
+        OUTBUF_PUT_LIT(out, "\nLast Date             : ");
+        summary_date(out, &s->last_dt);
+        OUTBUF_PUT_LIT(out, "\n");
+    }
+    if (s->undated) summary_printf(out, "Undated               : %d\n", s->undated);
+    if (s->unparsed) summary_printf(out, "Unparsed Amounts      : %d\n", s->unparsed);
+    summary_printf(out, "Credits               : %d totalling %s\n",
+                   s->total.credits, text(credits, s->total.credit_cents));
+    summary_printf(out, "Debits                : %d totalling %s\n",
+                   s->total.debits, text(debits, s->total.debit_cents));
+    summary_printf(out, "Net                   : %s\n",
+                   text(net, s->total.credit_cents + s->total.debit_cents));
+
+    if (!s->months.empty()) {
+        summary_printf(out, "\n%-7s  %7s %15s  %7s %15s %15s\n",
+                       "Month", "Credits", "Amount", "Debits", "Amount", "Net");
+        for (const SummaryMonth &m : s->months) {
+            summary_printf(out, "%04d-%02d  %7d %15s  %7d %15s %15s\n",
+                           m.month / 100, m.month % 100, m.credits, text(credits, m.credit_cents),
+                           m.debits, text(debits, m.debit_cents),
+                           text(net, m.credit_cents + m.debit_cents));
+        }
+    }
+
+    std::vector<uint32_t> payees = summary_top_payees(s, top);
+    if (!payees.empty()) {
+        summary_printf(out, "\n%4s  %-32s %15s %8s\n", "Rank", "Payee", "Spend", "Payments");
+        for (size_t k = 0; k < payees.size(); k++) {
+            uint32_t id = payees[k];
+            const char *name = text_ptr(s->payees.names[id]);
+            int len = (int)utf8_prefix(name, text_len(s->payees.names[id]), 32);
+            summary_printf(out, "%4zu  %-32.*s %15s %8d\n", k + 1, len, name,
+                           text(debits, s->spend[id].spend), s->spend[id].payments);
+        }
+    }
+}
+
+/* A count of credits or debits and their total as a JSON object */
+static void summary_json_totals(OutBuf *out, int count, int64_t cents) {
+    summary_printf(out, "{\"count\":%d,\"total\":", count);
+    summary_cents(out, cents);
+    OUTBUF_PUT_LIT(out, "}");
+}
+
+static void summary_write_json(const Summary *s, int top, OutBuf *out) {
+    summary_printf(out, "{\"transactions\":%d,\"first_date\":", s->transactions);
+    if (s->first <= s->last) {
+        OUTBUF_PUT_LIT(out, "\"");
+        summary_date(out, &s->first_dt);
+        OUTBUF_PUT_LIT(out, "\",\"last_date\":\"");
+        summary_date(out, &s->last_dt);
+        OUTBUF_PUT_LIT(out, "\"");
+    } else {
+        OUTBUF_PUT_LIT(out, "null,\"last_date\":null");
+    }
+    summary_printf(out, ",\"undated\":%d,\"unparsed_amounts\":%d,\"credits\":", s->undated, s->unparsed);
+    summary_json_totals(out, s->total.credits, s->total.credit_cents);
+    OUTBUF_PUT_LIT(out, ",\"debits\":");
+    summary_json_totals(out, s->total.debits, s->total.debit_cents);
+    OUTBUF_PUT_LIT(out, ",\"months\":[");
+    for (size_t k = 0; k < s->months.size(); k++) {
+        const SummaryMonth &m = s->months[k];
+        summary_printf(out, "%s{\"month\":\"%04d-%02d\",\"credits\":", k ? "," : "",
+                       m.month / 100, m.month % 100);
+        summary_json_totals(out, m.credits, m.credit_cents);
+        OUTBUF_PUT_LIT(out, ",\"debits\":");
+        summary_json_totals(out, m.debits, m.debit_cents);
+        OUTBUF_PUT_LIT(out, "}");
+    }
+    OUTBUF_PUT_LIT(out, "],\"top_payees\":[");
+    std::vector<uint32_t> payees = summary_top_payees(s, top);
+    for (size_t k = 0; k < payees.size(); k++) {
+        uint32_t id = payees[k];
+        if (k) OUTBUF_PUT_LIT(out, ",");
+        OUTBUF_PUT_LIT(out, "{\"payee\":");
+        json_string(out, text_ptr(s->payees.names[id]), text_len(s->payees.names[id]));
+        OUTBUF_PUT_LIT(out, ",\"spend\":");
+        summary_cents(out, s->spend[id].spend);
+        summary_printf(out, ",\"payments\":%d}", s->spend[id].payments);
+    }
+    OUTBUF_PUT_LIT(out, "]}\n");
+}
+
+/* Write s to out as a SUMMARY_* style, with the top payees by spend */
+void summary_write(const Summary *s, int style, int top, OutBuf *out) {
+    if (style == SUMMARY_JSON) summary_write_json(s, top, out);
+    else summary_write_table(s, top, out);
+}
+
+} /* namespace qxf2qif::detail */
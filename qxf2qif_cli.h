@@ -0,0 +1,93 @@
+/*
+ * qxf2qif_cli.h
+ *
+ * Whole-file conversion, merging and the --summary report, used by the
+ * qxf2qif program only. Built into an internal static library that is
+ * not installed.
+ */
+
+#ifndef QXF2QIF_CLI_H
+#define QXF2QIF_CLI_H
+
+#include "qxf2qif_internal.h"
+
+namespace qxf2qif::detail {
+
+/* Settings for converting one file */
+typedef struct {
+    ConvertOptions convert;
+    bool           populate;   /* MAP_POPULATE the input mapping */
+    bool           stream;     /* read in chunks instead of loading whole */
+    int            threads;    /* threads for a single whole-buffer input */
+    bool           listing;    /* write the -vv listing to stdout */
+    bool           summary;    /* total the records written into FileResult.summary */
+} FileOptions;
+
+/* Outcome of converting one file */
+typedef struct {
+    int            status;     /* 0, or the exit code main() reports */
+    const char    *error;      /* message for a non-zero status */
+    ConvertCounts  counts;
+    size_t         bytes_in;
+    double         seconds;
+    Summary       *summary;    /* with FileOptions.summary, else NULL; the caller
+                                  frees it with summary_free(), even on failure */
+} FileResult;
+
+int file_fail(FileResult *res, int status, const char *error);
+int convert_file(const char *inName, const char *const outNames[FORMAT_COUNT],
+                 const FileOptions *fo, FileResult *res);
+
+/*
+ * Transaction table: parsed transactions stored column by column, filled
+ * through its collect hook (OutputSet.collect = table_collect,
+ * collect_user = the table), for passes that need a file's transactions
+ * after the parse without reading the OFX text again.
+ */
+typedef struct TxnTable TxnTable;
+
+TxnTable *table_new(void);
+void table_free(TxnTable *t);
+void table_reset(TxnTable *t);
+void table_collect(void *table, const Record *r);
+int table_failed(const TxnTable *t);
+size_t table_rows(const TxnTable *t);
+size_t table_bytes(const TxnTable *t);
+void table_row(const TxnTable *t, size_t i, Record *r);
+void table_order_by_date(const TxnTable *t, uint32_t *order);
+int table_has_bank(const TxnTable *t);
+
+/*
+ * Merger: transactions of several inputs written as one document sorted
+ * by posted date. Inputs may be added from several threads at once.
+ * Transactions are kept in memory up to memory_limit bytes, counting the
+ * inputs still being read; beyond it they are sorted into runs spilled
+ * to temporary files.
+ */
+typedef struct Merger Merger;
+
+/* Default --memory-limit, in MiB */
+#define MERGE_MEMORY_DEFAULT 512
+
+Merger *merger_new(size_t memory_limit, bool dedup);
+int merger_add(Merger *m, size_t index, const char *inName, const FileOptions *fo, FileResult *res);
+int merger_write(Merger *m, const char *const outNames[FORMAT_COUNT], const FileOptions *fo,
+                 FileResult *res);
+int merger_spilled(const Merger *m);
+void merger_free(Merger *m);
+
+/* --summary styles */
+enum {
+    SUMMARY_TABLE,
+    SUMMARY_JSON
+};
+
+/* Payees listed by --summary unless --top says otherwise */
+#define SUMMARY_TOP_DEFAULT 10
+
+int summary_style_parse(const char *name, int *style);
+void summary_write(const Summary *s, int style, int top, OutBuf *out);
+
+} /* namespace qxf2qif::detail */
+
+#endif /* QXF2QIF_CLI_H */
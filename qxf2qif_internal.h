@@ -0,0 +1,387 @@
+/*
+ * qxf2qif_internal.h
+ *
+ * Converter internals shared by the library, the qxf2qif program and the
+ * benchmarks, in namespace qxf2qif::detail. The library builds them with
+ * hidden visibility; the program and benchmarks link the same objects
+ * through an internal static library. Not installed; library users
+ * include qxf2qif.h instead.
+ */
+
+#ifndef QXF2QIF_INTERNAL_H
+#define QXF2QIF_INTERNAL_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "qxf2qif.h"
+
+namespace qxf2qif::detail {
+
+#define MAX_FIELD 4096
+
+/* Input file contents, NUL terminated at data[len].
+ * map_len is non-zero when data is a private read-only mapping of the
+ * file; otherwise data was read into a malloc'd buffer.
+ */
+typedef struct {
+    const char *data;
+    size_t      len;
+    size_t      map_len;
+} InputBuffer;
+
+char *read_file_all(const char *path, long *out_len);
+int input_open(const char *path, bool populate, InputBuffer *in);
+void input_close(InputBuffer *in);
+
+/* Field and tag helpers of the original converter */
+bool fold_equal(const char *a, const char *b, size_t n);
+bool name_is(const char *name, const char *lit);
+char *strcasestr_simple(const char *hay, const char *needle);
+void extract_tag_content(const char *src, const char *end, const char *tag,
+                         char *out, size_t outsize);
+void trim_inplace(char *s);
+int ofxdate_to_mmddyyyy(const char *token, char *out, size_t outlen);
+
+/* An OFX date and time. Parts the token leaves out are zero. */
+typedef struct {
+    int16_t year;
+    int8_t  month, day;
+    int8_t  hour, minute, second;
+    int16_t millis;
+    int16_t offset_minutes;     /* east of UTC, from the [H:NAME] suffix */
+    bool    has_time;
+    bool    has_zone;
+    char    zone[8];            /* zone name, e.g. "EST" */
+} OfxDateTime;
+
+/* Longest DTPOSTED text the parser looks at through ofxdate_to_mmddyyyy() */
+#define OFX_DATETIME_MAX 64
+
+size_t ofx_parse_datetime(const char *p, size_t n, OfxDateTime *dt);
+
+/* Output date layout, compiled from a strftime-style string */
+#define DATE_LAYOUT_MAX     32
+#define DATE_LAYOUT_DEFAULT "%m/%d/%Y"
+
+typedef struct {
+    int  n;
+    char op[DATE_LAYOUT_MAX];   /* conversion letter, or 0 for a literal */
+    char lit[DATE_LAYOUT_MAX];
+} DateLayout;
+
+/* Room needed for a formatted date: up to 4 bytes per layout item */
+#define DATE_TEXT_MAX (4 * DATE_LAYOUT_MAX)
+/* Unparseable dates are copied through, cut to this many bytes */
+#define DATE_RAW_MAX  15
+
+/* Room for a formatted amount: sign, 17 digits, point and 2 decimals */
+#define AMOUNT_TEXT_MAX 24
+
+int amount_parse(const char *p, size_t n, int64_t *cents);
+size_t amount_format(int64_t cents, char *out);
+
+int date_layout_compile(DateLayout *layout, const char *fmt);
+size_t date_layout_format(const DateLayout *layout, const OfxDateTime *dt, char *out);
+
+/* %Y-%m-%d, as CSV, JSON Lines and ledger write dates */
+extern const DateLayout iso_date_layout;
+int find_next_stmttrn(const char *buf, const char *bufend, const char **startptr, const char **endptr);
+
+/*
+ * Seen index: (account, FITID) pairs already converted, kept across runs
+ * in a memory-mapped hash table file. The file stays locked from
+ * seen_open() to seen_close(); pairs found in a conversion are pending
+ * until seen_commit() adds them, so a failed conversion records nothing.
+ * One thread at a time.
+ */
+typedef struct SeenIndex SeenIndex;
+
+SeenIndex *seen_open(const char *path);
+int seen_check(SeenIndex *si, const char *acct, size_t acct_len, const char *fitid, size_t fitid_len);
+int seen_commit(SeenIndex *si);
+void seen_discard(SeenIndex *si);
+void seen_close(SeenIndex *si);
+
+/* Hash of an (account, FITID) pair, never 0, and the slot of an open
+ * addressing table of such hashes (capacity a power of two) that holds
+ * h or, if it is not there, where it goes */
+uint64_t seen_hash(const char *acct, size_t acct_len, const char *fitid, size_t fitid_len);
+uint64_t *seen_probe(uint64_t *slots, uint64_t capacity, uint64_t h);
+
+/* Output formats; several can be written from one parse */
+enum {
+    FORMAT_QIF,
+    FORMAT_CSV,
+    FORMAT_JSONL,
+    FORMAT_LEDGER,      /* ledger / hledger journal */
+    FORMAT_COUNT
+};
+
+#define FORMAT_BIT(f) (1u << (f))
+
+int output_format_parse(const char *list, unsigned *formats);
+const char *output_format_extension(int format);
+
+/* Conversion settings shared by every block */
+typedef struct {
+    unsigned formats;   /* FORMAT_BIT() of every format written */
+    bool memo;          /* emit M (memo) lines */
+    bool stats;         /* time each phase into ConvertCounts.phases */
+    const DateLayout *date_layout;  /* NULL for DATE_LAYOUT_DEFAULT */
+    bool raw_text;      /* copy NAME and MEMO bytes as sent, not as UTF-8 */
+    const struct Utf8Table *transcode;  /* per input: charset to UTF-8, or NULL */
+    bool xml;           /* per input: OFX 2.x, text may hold entities and CDATA */
+    SeenIndex *seen;    /* if set, drop transactions already in it; forces
+                           a single thread per input */
+} ConvertOptions;
+
+/* Fields of the OFX header that decide the syntax and text encoding */
+typedef struct {
+    char encoding[16];      /* e.g. "USASCII", "UTF-8"; for XML the
+                               encoding of the <?xml?> declaration */
+    char charset[16];       /* e.g. "1252", "ISO-8859-1", "NONE" */
+    bool xml;               /* an <?xml?> or <?OFX?> prolog: OFX 2.x */
+} OfxHeader;
+
+/* The header is looked for in this many leading bytes */
+#define OFX_HEADER_MAX 4096
+/* An OFX 2.x prolog must start within this many bytes */
+#define OFX_XML_SNIFF  512
+
+void ofx_parse_header(const char *p, size_t n, OfxHeader *h);
+void convert_options_for_input(const ConvertOptions *base, const char *head, size_t len,
+                               ConvertOptions *opts);
+int output_charset_parse(const char *name, bool *raw);
+
+/* Conversion phases timed by --stats */
+enum {
+    PHASE_READ,         /* loading or reading the input */
+    PHASE_SCAN,         /* looking for the next <STMTTRN> */
+    PHASE_EXTRACT,      /* collecting the fields of one transaction */
+    PHASE_FORMAT,       /* building the output records */
+    PHASE_WRITE,        /* handing output to the kernel */
+    PHASE_COUNT
+};
+
+/* Seconds spent per phase, summed over the threads doing the work.
+ * Scan, extract and format interleave per transaction, so they share the
+ * CPU time of their loop in proportion to their wall time.
+ */
+typedef struct {
+    double wall[PHASE_COUNT];
+    double cpu[PHASE_COUNT];
+} PhaseTimes;
+
+/* Running totals for one conversion; value-initialise (ConvertCounts())
+ * to start from zero. */
+typedef struct {
+    int        transactions;
+    int        skipped;         /* <STMTTRN> blocks dropped for lacking an amount */
+    int        duplicates;      /* transactions dropped as already seen */
+    bool       memos_excluded;  /* memos were present but not written */
+    PhaseTimes phases;          /* filled only with ConvertOptions.stats */
+} ConvertCounts;
+
+void counts_add(ConvertCounts *to, const ConvertCounts *from);
+double thread_cpu_seconds(void);
+
+/*
+ * Output buffer.
+ *
+ * Records are formatted straight into one contiguous buffer and handed
+ * to write() (or a sink callback) in large blocks, instead of going
+ * through a printf call and the stdio lock for every line.
+ */
+typedef struct {
+    int              fd;         /* -1: keep everything in memory, growing as needed */
+    qxf2qif_write_fn sink;       /* if set, receives the output instead of fd */
+    void            *sink_user;
+    PhaseTimes      *times;      /* if set, write time is added to PHASE_WRITE */
+    char            *data;
+    size_t           len;
+    size_t           cap;
+    bool             error;      /* a write failed; later output is dropped */
+} OutBuf;
+
+#define OUTBUF_MIN (64 * 1024)
+
+size_t outbuf_estimate(size_t input_len);
+int outbuf_init(OutBuf *ob, int fd, size_t cap);
+int outbuf_init_sink(OutBuf *ob, qxf2qif_write_fn sink, void *user, size_t cap);
+void outbuf_free(OutBuf *ob);
+int outbuf_flush(OutBuf *ob);
+void outbuf_put(OutBuf *ob, const char *p, size_t n);
+void outbuf_keep_spare(bool on);
+
+#define OUTBUF_PUT_LIT(ob, lit) outbuf_put((ob), (lit), sizeof(lit) - 1)
+
+void json_string(OutBuf *out, const char *p, size_t n);
+size_t utf8_prefix(const char *p, size_t n, size_t max);
+
+/*
+ * Bump allocator for data that outlives the parse of one transaction.
+ * Allocations are freed all at once: arena_reset() keeps the blocks for
+ * the next file, arena_free() returns them.
+ */
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock *first;
+    ArenaBlock *current;        /* block being carved, NULL before the first */
+    char       *ptr, *end;      /* free part of current */
+    size_t      used;           /* bytes handed out since the last reset */
+} Arena;
+
+#define ARENA_BLOCK (1024 * 1024)
+
+void arena_init(Arena *a);
+void *arena_alloc(Arena *a, size_t n);
+void arena_reset(Arena *a);
+void arena_free(Arena *a);
+size_t arena_used(const Arena *a);
+
+/* Text copied into an arena, prefixed with its length; NULL is empty */
+const char *text_put(Arena *a, bool *error, const char *p, size_t n);
+size_t text_len(const char *s);
+const char *text_ptr(const char *s);
+
+/* Distinct names, each stored once as a text_put() string and found by
+ * hash: open addressing with linear probing. A slot holds the top half
+ * of its name's hash, which also places it, over the index into names
+ * + 1, so a probe reads the text only on a likely match. */
+typedef struct {
+    std::vector<const char *> names;
+    std::vector<uint64_t>     slots;    /* hash >> 32 << 32 | (index + 1), 0 empty */
+} NameIndex;
+
+void names_clear(NameIndex *ix);
+uint32_t names_intern(NameIndex *ix, Arena *a, bool *error, const char *p, size_t n);
+
+/* Account types of a QIF section */
+enum {
+    ACCOUNT_BANK,       /* <STMTRS>, and transactions outside any statement */
+    ACCOUNT_CCARD       /* <CCSTMTRS> */
+};
+
+/* Where the output stands between QIF sections */
+enum {
+    SECTION_NONE,       /* nothing written yet: a lone record needs !Type:Bank first */
+    SECTION_CONTINUED,  /* the range continues a section started before it */
+    SECTION_PENDING,    /* a statement has begun; its header is not written yet */
+    SECTION_OPEN        /* records go into the section last written */
+};
+
+/* Longest ACCTID kept for the !Account header (OFX allows 22 characters) */
+#define ACCTID_MAX 32
+
+/* Statement tracking for one range of input. Each <STMTRS> or <CCSTMTRS>
+ * becomes an !Account section named after its ACCTID, written just before
+ * the statement's first transaction.
+ */
+typedef struct {
+    int  state;                 /* SECTION_* */
+    int  type;                  /* ACCOUNT_* of the latest statement */
+    bool loose;                 /* SECTION_CONTINUED: records were written
+                                   before any statement began */
+    char acctid[ACCTID_MAX + 1];
+} QifSection;
+
+/* One parsed transaction, as the output formats see it. The pointers
+ * are valid only while it is being written. */
+typedef struct {
+    OfxDateTime       dt;
+    bool              dated;        /* dt is valid; otherwise use raw_date */
+    const char       *raw_date;     /* DTPOSTED as sent, cut to DATE_RAW_MAX */
+    size_t            raw_date_len;
+    bool              parsed;       /* cents is valid; otherwise use raw_amount */
+    int64_t           cents;
+    const char       *raw_amount;
+    size_t            raw_amount_len;
+    const char       *fitid;
+    size_t            fitid_len;
+    const char       *name;         /* UTF-8 with CR and LF made spaces */
+    size_t            name_len;
+    const char       *memo;         /* likewise; empty if memos are excluded */
+    size_t            memo_len;
+    const QifSection *account;      /* statement the transaction belongs to */
+} Record;
+
+int64_t record_key(const Record *r);
+
+typedef struct Summary Summary;
+
+/* Where the records of a conversion go: the buffer of each format being
+ * written (NULL for the others), if set a Summary they are added to and,
+ * if collect is set, a callback that gets every record in input order,
+ * to keep what it needs. A collect hook makes convert_parallel() use a
+ * single thread; a summary does not, the pieces' summaries are merged. */
+typedef struct {
+    OutBuf  *buf[FORMAT_COUNT];
+    Summary *summary;
+    void   (*collect)(void *user, const Record *r);
+    void    *collect_user;
+} OutputSet;
+
+void qif_begin(QifSection *sec, int state);
+void qif_end(QifSection *sec, const OutputSet *out);
+void section_open(QifSection *sec, const OutputSet *out);
+void outputs_begin(const OutputSet *out);
+void outputs_record(const OutputSet *out, const Record *r, const ConvertOptions *opts);
+int convert_range(const char *begin, const char *end, const ConvertOptions *opts,
+                  QifSection *sec, const OutputSet *out, OutBuf *listing, ConvertCounts *counts);
+int convert_parallel(const char *begin, const char *end, int nthreads,
+                     const ConvertOptions *opts, const OutputSet *out, OutBuf *listing,
+                     ConvertCounts *counts);
+
+/* Bytes requested from the input per read in --stream mode */
+#define STREAM_CHUNK (1024 * 1024)
+
+int convert_stream(FILE *fin, const OutputSet *out, OutBuf *listing,
+                   const ConvertOptions *opts, ConvertCounts *counts);
+
+double now_seconds(void);
+
+/*
+ * Summary of the records written, for --summary: credits and debits per
+ * month, spend per payee and the range of posted dates, added up one
+ * record at a time while converting, with no second pass.
+ */
+typedef struct {
+    int32_t month;                      /* YYYYMM; 0 for the totals */
+    int     credits, debits;            /* number of each */
+    int64_t credit_cents, debit_cents;  /* debit_cents is negative */
+} SummaryMonth;
+
+typedef struct {
+    int64_t spend;                      /* cents of the payee's debits, positive */
+    int     payments;                   /* number of them */
+} SummaryPayee;
+
+struct Summary {
+    int                       transactions;
+    int                       undated;      /* posted date did not parse */
+    int                       unparsed;     /* amount did not parse; not in the totals */
+    int64_t                   first, last;  /* record_key() of the dated records' range */
+    OfxDateTime               first_dt, last_dt;
+    SummaryMonth              total;
+    std::vector<SummaryMonth> months;       /* by month */
+    size_t                    month;        /* index of the month last added to */
+    NameIndex                 payees;
+    std::vector<SummaryPayee> spend;        /* by index in payees */
+    Arena                     arena;        /* payee names */
+    bool                      error;        /* out of memory; the totals are incomplete */
+};
+
+Summary *summary_new(void);
+void summary_free(Summary *s);
+void summary_add(Summary *s, const Record *r);
+void summary_merge(Summary *to, const Summary *from);
+int summary_failed(const Summary *s);
+
+} /* namespace qxf2qif::detail */
+
+#endif /* QXF2QIF_INTERNAL_H */